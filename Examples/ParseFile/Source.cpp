@@ -48,6 +48,7 @@ int main(int, char*)
 		std::cout << "Transform:" << '\n';
 		std::cout << "    Name: " << transform.name << '\n';
 		std::cout << "    Hidden: " << transform.hidden << '\n';
+		if (transform.layer_index < voxel_scene.layers.size()) std::cout << "    Layer: " << voxel_scene.layers[transform.layer_index].name << '\n';
 		const VoxReader::Vector& position = transform.GetPosition();
 		std::cout << "    World position: " << position.x << ", " << position.y << ", " << position.z << '\n';
 		std::cout << "    Local position: " << transform.local_position.x << ", " << transform.local_position.y << ", " << transform.local_position.z << '\n';
@@ -76,7 +77,7 @@ int main(int, char*)
 		{
 			std::cout << "        Child transform: " << child_transform_index;
 
-			const std::string& child_name = voxel_scene.transforms[child_transform_index].name;
+			const std::pmr::string& child_name = voxel_scene.transforms[child_transform_index].name;
 			if (!child_name.empty())
 			{
 				std::cout << " (" << voxel_scene.transforms[child_transform_index].name << ')';
@@ -88,6 +89,16 @@ int main(int, char*)
 
 	std::cout << '\n';
 
+	for (const VoxReader::Layer& layer : voxel_scene.layers)
+	{
+		std::cout << "Layer:" << '\n';
+		std::cout << "    Name: " << layer.name << '\n';
+		std::cout << "    Hidden: " << layer.hidden << '\n';
+		std::cout << '\n';
+	}
+
+	std::cout << '\n';
+
 	std::size_t diffuse_material_count = 0;
 	for (std::size_t i = 0; i < 256; i++)
 	{
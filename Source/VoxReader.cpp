@@ -6,12 +6,37 @@
 
 #include "VoxReader.hpp"
 
-#include <map>
 #include <array>
 #include <cmath>
+#include <atomic>
+#include <thread>
+#include <istream>
+#include <ostream>
 #include <cassert>
+#include <cstring>
+#include <cstddef>
+#include <condition_variable>
 #include <charconv>
+#include <optional>
+#include <new>
+#include <algorithm>
 #include <string_view>
+#include <unordered_map>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define VOXREADER_SSE2
+#include <emmintrin.h>
+#endif
+
+// MSVC doesn't report SSSE3 support below /arch:AVX, but can always compile its intrinsics.
+#if defined(__SSSE3__) || defined(__AVX__) || (defined(VOXREADER_SSE2) && defined(VOXREADER_ENABLE_SSSE3))
+#define VOXREADER_SSSE3
+#include <tmmintrin.h>
+#endif
 
 namespace VoxReader
 {
@@ -53,7 +78,8 @@ namespace VoxReader
 			0xFFBBBBBB, 0xFFAAAAAA, 0xFF888888, 0xFF777777, 0xFF555555, 0xFF444444, 0xFF222222, 0xFF111111
 		};
 
-		const std::map<std::string_view, Material::Type> type_mapping
+		// Constant arrays instead of maps, so they don't have to be destroyed while an AsyncSceneLoad that got dropped might still be using them.
+		constexpr std::pair<std::string_view, Material::Type> type_mapping[]
 		{
 			{"_diffuse", Material::DIFFUSE},
 			{"_metal", Material::METAL},
@@ -63,7 +89,7 @@ namespace VoxReader
 			{"_cloud", Material::CLOUD}
 		};
 
-		const std::map<std::string_view, Material::MediaType> media_type_mapping
+		constexpr std::pair<std::string_view, Material::MediaType> media_type_mapping[]
 		{
 			{"_absorb", Material::ABSORB},
 			{"_scatter", Material::SCATTER},
@@ -71,6 +97,35 @@ namespace VoxReader
 			{"_sss", Material::SUBSURFACE_SCATTERING},
 		};
 
+		template <typename Type, usize Size>
+		Type FindMapping(const std::pair<std::string_view, Type> (&mapping)[Size], const std::string_view& key)
+		{
+			for (const auto& [name, value] : mapping)
+			{
+				if (name == key) return value;
+			}
+
+			assert(false && "Unknown material property value!");
+			return mapping[0].second;
+		}
+
+		template <typename Type, usize Size>
+		std::string_view FindMappingName(const std::pair<std::string_view, Type> (&mapping)[Size], const Type value)
+		{
+			for (const auto& [name, mapped_value] : mapping)
+			{
+				if (mapped_value == value) return name;
+			}
+
+			return mapping[0].first;
+		}
+
+		bool MaterialsEqual(const Material& a, const Material& b)
+		{
+			return a.type == b.type && a.media_type == b.media_type && a.roughness == b.roughness && a.ior == b.ior && a.specular == b.specular && a.emission == b.emission &&
+				a.power == b.power && a.ldr == b.ldr && a.metallic == b.metallic && a.transparency == b.transparency && a.density == b.density && a.phase == b.phase;
+		}
+
 		struct VoxHeader
 		{
 			char id[4]{ "" };
@@ -132,18 +187,23 @@ namespace VoxReader
 			return { string, string_size };
 		}
 
-		using StringMap = std::map<std::string_view, std::string_view>;
+		// View of a DICT in the file's data, reading one doesn't allocate, finding a key walks over the (few) key value pairs instead.
+		struct StringMap
+		{
+			const void* data{ nullptr };
+			uint32 size{ 0 };
+		};
 
 		StringMap ReadDict(const void*& pointer)
 		{
-			const uint32 map_size = ReadData<uint32>(pointer);
-
 			StringMap map;
-			for (usize i = 0; i < map_size; i++)
+			map.size = ReadData<uint32>(pointer);
+			map.data = pointer;
+
+			for (usize i = 0; i < map.size; i++)
 			{
-				const std::string_view key = ReadString(pointer);
-				const std::string_view value = ReadString(pointer);
-				map[key] = value;
+				ReadString(pointer); // Key.
+				ReadString(pointer); // Value.
 			}
 
 			return map;
@@ -157,13 +217,20 @@ namespace VoxReader
 			return value;
 		}
 
-		// Slightly cleaner interface for the std::map::find function.
-		const std::string_view* MapFind(const StringMap& map, const std::string_view& key)
+		// Returns the value of the key in the map, the last one if the key is in there more than once.
+		std::optional<std::string_view> MapFind(const StringMap& map, const std::string_view& key)
 		{
-			const auto& iterator = map.find(key);
-			if (iterator == map.end()) return nullptr;
+			std::optional<std::string_view> value;
+
+			const void* data = map.data;
+			for (usize i = 0; i < map.size; i++)
+			{
+				const std::string_view entry_key = ReadString(data);
+				const std::string_view entry_value = ReadString(data);
+				if (entry_key == key) value = entry_value;
+			}
 
-			return &iterator->second;
+			return value;
 		}
 
 		// Parse a std::string_view containing 3 values separated by spaces (needed for the nTRN chunk's frame attribute translation).
@@ -259,7 +326,7 @@ namespace VoxReader
 				largest_index = 3;
 			}
 
-			const float largest_value = std::sqrtf(four_biggest_squared_minus1 + 1.0f) * 0.5f;
+			const float largest_value = std::sqrt(four_biggest_squared_minus1 + 1.0f) * 0.5f;
 			const float multiplier = 0.25f / largest_value;
 
 			switch (largest_index)
@@ -305,6 +372,214 @@ namespace VoxReader
 				return Quaternion{};
 			}
 		}
+
+		// Vector multiplication with matrix, including the translation of the matrix.
+		Vector TransformPoint(const Vector& point, const Matrix& matrix)
+		{
+			Vector result = point;
+			result *= matrix;
+			result.x += matrix.cells[3][0];
+			result.y += matrix.cells[3][1];
+			result.z += matrix.cells[3][2];
+
+			return result;
+		}
+
+		// Inverts a matrix that only contains a 3x3 linear part and a translation (like all transform matrices).
+		Matrix InverseAffine(const Matrix& matrix)
+		{
+			const float (&m)[4][4] = matrix.cells;
+
+			Matrix inverse{};
+			inverse.cells[0][0] = m[1][1] * m[2][2] - m[1][2] * m[2][1];
+			inverse.cells[0][1] = m[0][2] * m[2][1] - m[0][1] * m[2][2];
+			inverse.cells[0][2] = m[0][1] * m[1][2] - m[0][2] * m[1][1];
+			inverse.cells[1][0] = m[1][2] * m[2][0] - m[1][0] * m[2][2];
+			inverse.cells[1][1] = m[0][0] * m[2][2] - m[0][2] * m[2][0];
+			inverse.cells[1][2] = m[0][2] * m[1][0] - m[0][0] * m[1][2];
+			inverse.cells[2][0] = m[1][0] * m[2][1] - m[1][1] * m[2][0];
+			inverse.cells[2][1] = m[0][1] * m[2][0] - m[0][0] * m[2][1];
+			inverse.cells[2][2] = m[0][0] * m[1][1] - m[0][1] * m[1][0];
+
+			const float determinant = m[0][0] * inverse.cells[0][0] + m[0][1] * inverse.cells[1][0] + m[0][2] * inverse.cells[2][0];
+			assert(determinant != 0.0f && "Can't invert a matrix with a determinant of 0!");
+
+			const float inverse_determinant = 1.0f / determinant;
+			for (usize row = 0; row < 3; row++)
+			{
+				for (usize column = 0; column < 3; column++)
+				{
+					inverse.cells[row][column] *= inverse_determinant;
+				}
+			}
+
+			Vector translation{ -m[3][0], -m[3][1], -m[3][2] };
+			translation *= inverse;
+			inverse.cells[3][0] = translation.x;
+			inverse.cells[3][1] = translation.y;
+			inverse.cells[3][2] = translation.z;
+
+			return inverse;
+		}
+
+		// Finalizer of splitmix64, scrambles all bits of the value.
+		uint64 MixHash(uint64 value)
+		{
+			value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ull;
+			value = (value ^ (value >> 27)) * 0x94D049BB133111EBull;
+			return value ^ (value >> 31);
+		}
+
+		// Fast non-cryptographic 64 bit hash, hashes 4 independent 8 byte lanes at a time to keep the multipliers busy.
+		uint64 HashBytes(const void* data, const usize byte_count, const uint64 seed = 0)
+		{
+			constexpr uint64 multiplier = 0x9E3779B97F4A7C15ull;
+
+			const uint8* bytes = static_cast<const uint8*>(data);
+			uint64 lanes[4]{ seed, seed + multiplier, seed ^ 0xD6E8FEB86659FD93ull, seed - multiplier };
+
+			usize i = 0;
+			for (; i + 32 <= byte_count; i += 32)
+			{
+				for (usize lane = 0; lane < 4; lane++)
+				{
+					uint64 word;
+					std::memcpy(&word, bytes + i + lane * 8, sizeof(word));
+					lanes[lane] = (lanes[lane] ^ word) * multiplier;
+					lanes[lane] ^= lanes[lane] >> 29;
+				}
+			}
+
+			uint64 hash = MixHash(lanes[0]) ^ MixHash(lanes[1] + 1) ^ MixHash(lanes[2] + 2) ^ MixHash(lanes[3] + 3);
+			for (; i + 8 <= byte_count; i += 8)
+			{
+				uint64 word;
+				std::memcpy(&word, bytes + i, sizeof(word));
+				hash = MixHash(hash ^ word);
+			}
+
+			uint64 tail = 0;
+			std::memcpy(&tail, bytes + i, byte_count - i);
+			return MixHash(hash ^ tail ^ (static_cast<uint64>(byte_count) << 56));
+		}
+
+		// Index of the lowest set bit, value must not be 0.
+		usize CountTrailingZeros(const uint64 value)
+		{
+#ifdef _MSC_VER
+			unsigned long index;
+			_BitScanForward64(&index, value);
+			return index;
+#else
+			return static_cast<usize>(__builtin_ctzll(value));
+#endif
+		}
+
+		// Calls function(i) for every i in the range [0 ~ count), spread over all hardware threads (the calling thread included).
+		template <typename Function>
+		void ParallelFor(const usize count, const Function& function)
+		{
+			const usize thread_count = std::min<usize>(count, std::max(1u, std::thread::hardware_concurrency()));
+			if (thread_count <= 1)
+			{
+				for (usize i = 0; i < count; i++) function(i);
+				return;
+			}
+
+			std::atomic<usize> next_index{ 0 };
+			const auto worker = [&]()
+			{
+				for (usize i = next_index++; i < count; i = next_index++) function(i);
+			};
+
+			std::vector<std::thread> threads;
+			threads.reserve(thread_count - 1);
+			for (usize i = 1; i < thread_count; i++) threads.emplace_back(worker);
+
+			worker();
+			for (std::thread& thread : threads) thread.join();
+		}
+
+		// Amanatides-Woo traversal over the cells [cell_min ~ cell_max) of a grid with cubic cells of the given size, starting at ray parameter t_start.
+		// Calls visit(cell, t_enter, t_exit, entry_axis) for each cell the ray passes until it returns true (returns true) or the ray leaves the cell range or passes t_end (returns false).
+		template <typename Visitor>
+		bool TraverseGrid(const float (&origin)[3], const float (&direction)[3], const float t_start, const float t_end, const float cell_size, const sint32 (&cell_min)[3], const sint32 (&cell_max)[3], sint32 entry_axis, const Visitor& visit)
+		{
+			sint32 cell[3];
+			sint32 step[3];
+			float t_max[3];
+			float t_delta[3];
+			for (usize axis = 0; axis < 3; axis++)
+			{
+				const float position = origin[axis] + direction[axis] * t_start;
+				cell[axis] = std::clamp(static_cast<sint32>(std::floor(position / cell_size)), cell_min[axis], cell_max[axis] - 1);
+
+				if (direction[axis] > 0.0f)
+				{
+					step[axis] = 1;
+					t_max[axis] = (static_cast<float>(cell[axis] + 1) * cell_size - origin[axis]) / direction[axis];
+					t_delta[axis] = cell_size / direction[axis];
+				}
+				else if (direction[axis] < 0.0f)
+				{
+					step[axis] = -1;
+					t_max[axis] = (static_cast<float>(cell[axis]) * cell_size - origin[axis]) / direction[axis];
+					t_delta[axis] = -cell_size / direction[axis];
+				}
+				else
+				{
+					step[axis] = 0;
+					t_max[axis] = FLT_MAX;
+					t_delta[axis] = FLT_MAX;
+				}
+			}
+
+			float t_enter = t_start;
+			while (true)
+			{
+				sint32 axis = 0;
+				if (t_max[1] < t_max[axis]) axis = 1;
+				if (t_max[2] < t_max[axis]) axis = 2;
+
+				if (visit(cell, t_enter, std::min(t_max[axis], t_end), entry_axis)) return true;
+				if (t_max[axis] >= t_end) return false;
+
+				cell[axis] += step[axis];
+				if (cell[axis] < cell_min[axis] || cell[axis] >= cell_max[axis]) return false;
+
+				t_enter = t_max[axis];
+				t_max[axis] += t_delta[axis];
+				entry_axis = axis;
+			}
+		}
+
+		// Slab test of a ray against an axis aligned box, returns false if the ray misses the box within [t_near ~ t_far], otherwise clips the range to the box.
+		bool ClipRayToBox(const float (&origin)[3], const float (&direction)[3], const float (&box_min)[3], const float (&box_max)[3], float& t_near, float& t_far, sint32& entry_axis)
+		{
+			entry_axis = -1;
+			for (sint32 axis = 0; axis < 3; axis++)
+			{
+				if (direction[axis] == 0.0f)
+				{
+					if (origin[axis] < box_min[axis] || origin[axis] > box_max[axis]) return false;
+					continue;
+				}
+
+				const float inverse_direction = 1.0f / direction[axis];
+				float t_0 = (box_min[axis] - origin[axis]) * inverse_direction;
+				float t_1 = (box_max[axis] - origin[axis]) * inverse_direction;
+				if (t_0 > t_1) std::swap(t_0, t_1);
+
+				if (t_0 > t_near)
+				{
+					t_near = t_0;
+					entry_axis = axis;
+				}
+				t_far = std::min(t_far, t_1);
+			}
+
+			return t_near <= t_far;
+		}
 	}
 
 	void ReaderSettings::SetCoordinateSystem(const CoordSystem handedness, const CoordSystem up_axis)
@@ -331,7 +606,7 @@ namespace VoxReader
 		}
 	}
 
-	Transform::Transform(const Vector& position, const uint8 rotation, const ReaderSettings& reader_settings)
+	Transform::Transform(const Vector& position, const uint8 rotation, const ReaderSettings& reader_settings, const allocator_type& allocator) : name{ allocator }
 	{
 		matrix.cells[3][0] = position.x * reader_settings.voxel_scale.x;
 		matrix.cells[3][1] = position.y * reader_settings.voxel_scale.y;
@@ -371,397 +646,3675 @@ namespace VoxReader
 		}
 	}
 
-	Scene::Scene(const void* data, const usize data_size, const ReaderSettings& reader_settings)
-	{
-		const void* const data_end = static_cast<const uint8*>(data) + data_size;
-
-		const VoxHeader& file_header = ReadData<VoxHeader>(data); // Skip the voxel 
-		assert(std::string_view(file_header.id, 4) == "VOX " && "Voxel file is invalid, header not valid!"); // Check that the file is valid using the header id.
-
-		bool has_palette = false;
+	Transform::Transform(const Transform& other, const allocator_type& allocator) : name{ other.name, allocator }, matrix{ other.matrix }, hidden{ other.hidden }, layer_index{ other.layer_index }, local_position{ other.local_position }, local_rotation{ other.local_rotation } {}
 
-		SkipData(data, sizeof(ChunkHeader)); // Skip the root chunk (only has a header).
-		while (data < data_end)
-		{
-			// While we aren't at the end of the file, we try to process a new chunk.
-			const ChunkHeader& next_chunk = ReadData<ChunkHeader>(data);
+	Transform::Transform(Transform&& other, const allocator_type& allocator) : name{ std::move(other.name), allocator }, matrix{ other.matrix }, hidden{ other.hidden }, layer_index{ other.layer_index }, local_position{ other.local_position }, local_rotation{ other.local_rotation } {}
 
-			std::string_view chunk_id{ next_chunk.id, 4 };
-			if (chunk_id == "SIZE")
-			{
-				Model& model = models.emplace_back();
+	struct AsyncSceneLoad::State
+	{
+		std::vector<uint8> file_data;
+		ReaderSettings reader_settings;
+		Callbacks callbacks;
 
-				model.size = ReadData<Model::Size>(data);
-				if (reader_settings.flipped_up_axis)
-				{
-					const uint32 old_y = model.size.y;
-					model.size.y = model.size.z;
-					model.size.z = old_y;
-				}
+		Scene scene;
 
-				const uint32 voxel_count = model.size.x * model.size.y * model.size.z;
-				model.voxel_data.resize(voxel_count, 0);
+		std::atomic<float> progress{ 0.0f };
+		std::atomic<bool> cancelled{ false };
 
-				SkipData(data, sizeof(ChunkHeader)); // Skip the header for the XYZI chunk since it's guaranteed to be after the SIZE chunk.
+		std::mutex done_mutex;
+		std::condition_variable done_condition;
+		bool done{ false };
+	};
 
-				const uint32 stride_z = model.size.x * model.size.y;
+	namespace
+	{
+		struct Chunk
+		{
+			std::string_view id;
+			const void* content{ nullptr };
+			uint32 content_size{ 0 };
+		};
 
-				const ArrayView<uint32> packed_voxel_data = ReadArray<uint32>(data);
-				for (const uint32 voxel : packed_voxel_data)
-				{
-					uint32 x = voxel & 0xFF;
+		// All chunks of a file grouped by what they contain, this allows the chunks to be parsed in a different order than they're stored in.
+		struct ChunkIndex
+		{
+			// Pairs of SIZE and XYZI chunks, one per model.
+			std::vector<std::pair<Chunk, Chunk>> models;
+			// Content hash of each model's SIZE and XYZI chunks.
+			std::vector<uint64> model_hashes;
+			// Scene graph node chunks (nTRN, nGRP, nSHP) indexed by their node id.
+			std::vector<Chunk> nodes;
+			std::vector<Chunk> layers;
+			std::vector<Chunk> materials;
+			Chunk palette{};
+			Chunk index_map{};
+		};
 
-					uint32 y;
-					uint32 z;
-					if (reader_settings.flipped_up_axis)
-					{
-						y = (voxel >> 16) & 0xFF;
-						z = (voxel >> 8) & 0xFF;
-					}
-					else
-					{
-						y = (voxel >> 8) & 0xFF;
-						z = (voxel >> 16) & 0xFF;
-					}
+		ChunkIndex IndexChunks(const void* data, const usize data_size)
+		{
+			const void* const data_end = static_cast<const uint8*>(data) + data_size;
 
-					x = (reader_settings.flipped_handedness ? model.size.x - 1 - x : x);
-					z = (reader_settings.flipped_up_axis ? model.size.z - 1 - z : z);
+			const VoxHeader& file_header = ReadData<VoxHeader>(data);
+			assert(std::string_view(file_header.id, 4) == "VOX " && "Voxel file is invalid, header not valid!"); // Check that the file is valid using the header id.
 
-					const uint32 index = x + (y * model.size.x) + (z * stride_z);
-					model.voxel_data[index] = voxel >> 24;
-				}
-			}
-			else if (chunk_id == "RGBA")
-			{
-				// Read the 255 colors from the palette and copy them to the range [1 ~ 255] in the scene's palette (palette index 0 is skipped since it represents the absence of a voxel).
-				std::memcpy(&palette[1], data, 255 * sizeof(uint32));
-				SkipData(data, next_chunk.content_size);
+			ChunkIndex index;
 
-				has_palette = true;
-			}
-			else if (chunk_id == "nTRN")
+			SkipData(data, sizeof(ChunkHeader)); // Skip the root chunk (only has a header).
+			while (data < data_end)
 			{
-				// We hierarchically parse the nTRN chunks, so we can assume that this case will only be triggered once.
+				const ChunkHeader& header = ReadData<ChunkHeader>(data);
 
-				// First nTRN chunk is the root transform, which we can skip processing.
-				SkipData(data, next_chunk.content_size);
+				const Chunk chunk{ std::string_view{ header.id, 4 }, data, header.content_size };
+				SkipData(data, header.content_size);
 
-				// After the root nTRN chunk we get the root nGRP chunk, if it has no children there are no more transforms in the file.
-				SkipData(data, sizeof(ChunkHeader)); // Skip over the header, we know that it's a nGRP chunk.
+				if (chunk.id == "SIZE")
+				{
+					index.models.emplace_back(chunk, Chunk{});
+				}
+				else if (chunk.id == "XYZI")
+				{
+					assert(!index.models.empty() && "Invalid voxel file, XYZI chunk without SIZE chunk!");
+					index.models.back().second = chunk;
 
-				SkipData(data, sizeof(uint32)); // Skip over the node id.
-				ReadDict(data); // Ignore the node attributes.
+					const Chunk& size_chunk = index.models.back().first;
+					index.model_hashes.push_back(HashBytes(chunk.content, chunk.content_size, HashBytes(size_chunk.content, size_chunk.content_size)));
+				}
+				else if (chunk.id == "nTRN" || chunk.id == "nGRP" || chunk.id == "nSHP")
+				{
+					// Every node chunk starts with its node id.
+					const void* content = chunk.content;
+					const uint32 node_id = ReadData<uint32>(content);
 
-				// Get the root children, and for each child parse its children and so on.
-				const ArrayView<uint32> root_children = ReadArray<uint32>(data);
-				for (uint32 i = 0; i < root_children.size; i++)
+					if (node_id >= index.nodes.size()) index.nodes.resize(node_id + 1);
+					index.nodes[node_id] = chunk;
+				}
+				else if (chunk.id == "LAYR")
+				{
+					index.layers.push_back(chunk);
+				}
+				else if (chunk.id == "MATL")
+				{
+					index.materials.push_back(chunk);
+				}
+				else if (chunk.id == "RGBA")
+				{
+					index.palette = chunk;
+				}
+				else if (chunk.id == "IMAP")
 				{
-					SkipData(data, sizeof(ChunkHeader)); // Skip the child nTRN node's header.
-					ParseSceneGraph(data, reader_settings);
+					index.index_map = chunk;
 				}
 
+				// Unimplemented: rCAM, rOBJ, NOTE, MATT (deprecated, should be supported for compatibility), PACK.
 			}
-			else if (chunk_id == "MATL")
-			{
-				const uint32 material_id = ReadData<uint32>(data);
-				const StringMap material_properties = ReadDict(data);
 
-				Material& material = materials[material_id];
+			return index;
+		}
 
-				const std::string_view* material_type = MapFind(material_properties, "_type");
-				if (material_type != nullptr)
-				{
-					material.type = type_mapping.at(*material_type);
+		void ParseMaterial(const Chunk& chunk, Material (&materials)[256])
+		{
+			const void* data = chunk.content;
 
-					const std::string_view* media_type = MapFind(material_properties, "_media_type");
-					if (media_type != nullptr) material.media_type = media_type_mapping.at(*media_type);
+			const uint32 material_id = ReadData<uint32>(data);
+			const StringMap material_properties = ReadDict(data);
 
-					const std::string_view* roughness = MapFind(material_properties, "_rough");
-					if (roughness != nullptr) material.roughness = StringViewToData<float>(*roughness) * 100.0f; // Range is incorrect [0.0 ~ 1.0], multiply by 100 to compensate.
+			Material& material = materials[material_id];
 
-					// _ir seams to be the new name for ior since version 200.
-					const std::string_view* ior = MapFind(material_properties, "_ri");
-					if (ior != nullptr)
-					{
-						material.ior = StringViewToData<float>(*ior);
-					}
-					else
-					{
-						// Support the old name of ior as well.
-						ior = MapFind(material_properties, "_ior");
-						if (ior != nullptr) material.ior = StringViewToData<float>(*ior) + 1.0f; // Range is incorrect [0.0 ~ 2.0], add 1 to compensate.
-					}
+			std::optional<std::string_view> material_type = MapFind(material_properties, "_type");
+			if (!material_type.has_value()) return;
 
-					// _sp is the new name for _spec since version 200.
-					const std::string_view* specular = MapFind(material_properties, "_sp");
-					if (specular != nullptr)
-					{
-						material.specular = StringViewToData<float>(*specular);
-					}
-					else
-					{
-						// Support the old name of ior as well.
-						specular = MapFind(material_properties, "_spec");
-						if (specular != nullptr) material.specular = StringViewToData<float>(*specular) + 1.0f; // Range is incorrect [0.0 ~ 1.0], add 1 to compensate.
-					}
+			material.type = FindMapping(type_mapping, *material_type);
 
-					// _emit was _weight before version 200 (just like _trans).
-					const std::string_view* emission = MapFind(material_properties, "_emit");
-					if (emission != nullptr)
-					{
-						material.emission = StringViewToData<float>(*emission) * 100.0f; // Range is incorrect [0.0 ~ 2.0], add 1 to compensate.
-					}
-					else
-					{
-						// Support the old name of emission as well.
-						emission = MapFind(material_properties, "_weight");
-						if (specular != nullptr) material.emission = StringViewToData<float>(*emission) * 100.0f; // Range is incorrect [0.0 ~ 1.0], multiply by 100 to compensate.
-					}
+			std::optional<std::string_view> media_type = MapFind(material_properties, "_media_type");
+			if (media_type.has_value()) material.media_type = FindMapping(media_type_mapping, *media_type);
 
-					const std::string_view* power = MapFind(material_properties, "_flux");
-					if (power != nullptr) material.power = StringViewToData<uint8>(*power);
+			std::optional<std::string_view> roughness = MapFind(material_properties, "_rough");
+			if (roughness.has_value()) material.roughness = StringViewToData<float>(*roughness) * 100.0f; // Range is incorrect [0.0 ~ 1.0], multiply by 100 to compensate.
 
-					// _ldr was _glow before version 200.
-					const std::string_view* ldr = MapFind(material_properties, "_ldr");
-					if (ldr != nullptr)
-					{
-						material.ldr = StringViewToData<float>(*ldr) * 100.0f; // Range is incorrect [0.0 ~ 1.0], multiply by 100 to compensate.
-					}
-					else
-					{
-						ldr = MapFind(material_properties, "_glow");
-						if (ldr != nullptr) material.ldr = StringViewToData<float>(*ldr) * 100.0f; // Range is incorrect [0.0 ~ 1.0], multiply by 100 to compensate.
-					}
+			// _ir seams to be the new name for ior since version 200.
+			std::optional<std::string_view> ior = MapFind(material_properties, "_ri");
+			if (ior.has_value())
+			{
+				material.ior = StringViewToData<float>(*ior);
+			}
+			else
+			{
+				// Support the old name of ior as well.
+				ior = MapFind(material_properties, "_ior");
+				if (ior.has_value()) material.ior = StringViewToData<float>(*ior) + 1.0f; // Range is incorrect [0.0 ~ 2.0], add 1 to compensate.
+			}
 
-					const std::string_view* metallic = MapFind(material_properties, "_metal");
-					if (metallic != nullptr) material.metallic = StringViewToData<float>(*metallic) * 100.0f; // Range is incorrect [0.0 ~ 1.0], multiply by 100 to compensate.
+			// _sp is the new name for _spec since version 200.
+			std::optional<std::string_view> specular = MapFind(material_properties, "_sp");
+			if (specular.has_value())
+			{
+				material.specular = StringViewToData<float>(*specular);
+			}
+			else
+			{
+				// Support the old name of ior as well.
+				specular = MapFind(material_properties, "_spec");
+				if (specular.has_value()) material.specular = StringViewToData<float>(*specular) + 1.0f; // Range is incorrect [0.0 ~ 1.0], add 1 to compensate.
+			}
 
-					// _alpha and _trans seam to be the same value always? We'll ignore _alpha since I'm not sure how to use it. 
-					// _trans was _weight before version 200 (just like _emit).
-					const std::string_view* transparency = MapFind(material_properties, "_trans");
-					if (transparency != nullptr)
-					{
-						material.transparency = StringViewToData<float>(*transparency) * 100.0f; // Range is incorrect [0.0 ~ 1.0], multiply by 100 to compensate.
-					}
-					else
-					{
-						transparency = MapFind(material_properties, "_weight");
-						if (transparency != nullptr) material.transparency = StringViewToData<float>(*transparency) * 100.0f; // Range is incorrect [0.0 ~ 1.0], multiply by 100 to compensate.
-					}
+			// _emit was _weight before version 200 (just like _trans).
+			std::optional<std::string_view> emission = MapFind(material_properties, "_emit");
+			if (emission.has_value())
+			{
+				material.emission = StringViewToData<float>(*emission) * 100.0f; // Range is incorrect [0.0 ~ 2.0], add 1 to compensate.
+			}
+			else
+			{
+				// Support the old name of emission as well.
+				emission = MapFind(material_properties, "_weight");
+				if (emission.has_value()) material.emission = StringViewToData<float>(*emission) * 100.0f; // Range is incorrect [0.0 ~ 1.0], multiply by 100 to compensate.
+			}
 
-					// _d was _att before version 200.
-					const std::string_view* density = MapFind(material_properties, "_d");
-					if (density != nullptr)
-					{
-						material.density = StringViewToData<float>(*density) * 1000.0f; // Range is incorrect [0.0 ~ 0.1]????, multiply by 1000 to compensate.
-					}
-					else
-					{
-						density = MapFind(material_properties, "_att");
-						if (density != nullptr) material.density = StringViewToData<float>(*density) * 100.0f; // Range is incorrect [0.0 ~ 1.0], multiply by 100 to compensate.
-					}
+			std::optional<std::string_view> power = MapFind(material_properties, "_flux");
+			if (power.has_value()) material.power = StringViewToData<uint8>(*power);
 
-					const std::string_view* phase = MapFind(material_properties, "_g");
-					if (phase != nullptr) material.phase = StringViewToData<float>(*phase);
-				}
+			// _ldr was _glow before version 200.
+			std::optional<std::string_view> ldr = MapFind(material_properties, "_ldr");
+			if (ldr.has_value())
+			{
+				material.ldr = StringViewToData<float>(*ldr) * 100.0f; // Range is incorrect [0.0 ~ 1.0], multiply by 100 to compensate.
 			}
-			else // Skip unimplemented chunks.
+			else
 			{
-				// Unimplemented: IMAP, rCAM, rOBJ, NOTE, LAYR, MATT (deprecated, should be supported for compatibility), PACK.
-				SkipData(data, next_chunk.content_size);
+				ldr = MapFind(material_properties, "_glow");
+				if (ldr.has_value()) material.ldr = StringViewToData<float>(*ldr) * 100.0f; // Range is incorrect [0.0 ~ 1.0], multiply by 100 to compensate.
 			}
-		}
 
-		if (!has_palette)
-		{
-			// If no palette was included in the file, copy the default palette.
-			std::memcpy(palette, default_palette, sizeof(default_palette));
-		}
-
-		// Both of these settings require us to loop over each instance.
-		if (reader_settings.add_voxel_offsets || reader_settings.avoid_negative_scale)
-		{
-			// Mapping between old model indices and new inverse model indices (if a model index is not contained in the map, no instances that uses it has negative scaling).
-			std::map<uint32, uint32> inverse_model_map; // Unused if reader_settings.avoid_negative_scale == false.
+			std::optional<std::string_view> metallic = MapFind(material_properties, "_metal");
+			if (metallic.has_value()) material.metallic = StringViewToData<float>(*metallic) * 100.0f; // Range is incorrect [0.0 ~ 1.0], multiply by 100 to compensate.
 
-			for (Instance& instance : instances)
+			// _alpha and _trans seam to be the same value always? We'll ignore _alpha since I'm not sure how to use it. 
+			// _trans was _weight before version 200 (just like _emit).
+			std::optional<std::string_view> transparency = MapFind(material_properties, "_trans");
+			if (transparency.has_value())
 			{
-				if (reader_settings.add_voxel_offsets)
-				{
-					const Model& model = models[instance.model_index];
-					Transform& transform = transforms[instance.transform_index];
-
-					// If the scale of the model is an odd number on any axis, add half a voxel as an offset to align the instances correctly.
-					Vector offset
-					{
-						model.size.x & 0b1 ? (reader_settings.voxel_scale.x / 2.0f) : 0.0f,
-						model.size.y & 0b1 ? (reader_settings.voxel_scale.y / 2.0f) : 0.0f,
-						model.size.z & 0b1 ? (reader_settings.voxel_scale.z / 2.0f) : 0.0f
-					};
+				material.transparency = StringViewToData<float>(*transparency) * 100.0f; // Range is incorrect [0.0 ~ 1.0], multiply by 100 to compensate.
+			}
+			else
+			{
+				transparency = MapFind(material_properties, "_weight");
+				if (transparency.has_value()) material.transparency = StringViewToData<float>(*transparency) * 100.0f; // Range is incorrect [0.0 ~ 1.0], multiply by 100 to compensate.
+			}
 
-					// Make sure to flip the offset axes based on the coordinate system.
-					offset.x *= reader_settings.flipped_handedness ? -1.0f : 1.0f;
-					offset.z *= reader_settings.flipped_up_axis ? -1.0f : 1.0f;
+			// _d was _att before version 200.
+			std::optional<std::string_view> density = MapFind(material_properties, "_d");
+			if (density.has_value())
+			{
+				material.density = StringViewToData<float>(*density) * 1000.0f; // Range is incorrect [0.0 ~ 0.1]????, multiply by 1000 to compensate.
+			}
+			else
+			{
+				density = MapFind(material_properties, "_att");
+				if (density.has_value()) material.density = StringViewToData<float>(*density) * 100.0f; // Range is incorrect [0.0 ~ 1.0], multiply by 100 to compensate.
+			}
 
-					// Multiply by the offset by the transform's matrix to correctly rotate the offset.
-					if (reader_settings.flipped_handedness || reader_settings.flipped_up_axis)
-					{
-						offset *= transform.matrix;
-					}
+			std::optional<std::string_view> phase = MapFind(material_properties, "_g");
+			if (phase.has_value()) material.phase = StringViewToData<float>(*phase);
+		}
 
-					Vector& position = transform.GetPosition();
-					position.x += offset.x;
-					position.y += offset.y;
-					position.z += offset.z;
+		void ParseLayer(const Chunk& chunk, std::pmr::vector<Layer>& layers)
+		{
+			const void* data = chunk.content;
 
-					transform.local_position.x += offset.x;
-					transform.local_position.y += offset.y;
-					transform.local_position.z += offset.z;
-				}
+			const uint32 layer_id = ReadData<uint32>(data);
+			const StringMap layer_attributes = ReadDict(data);
 
-				// We check both settings again, otherwise if both of them are true we'd have to loop over all elements twice.
-				if (!reader_settings.avoid_negative_scale) continue;
+			if (layer_id >= layers.size()) layers.resize(layer_id + 1);
+			Layer& layer = layers[layer_id];
 
-				Matrix& matrix = transforms[instance.transform_index].matrix;
-				const float determinant = matrix.cells[0][0] * matrix.cells[1][1] * matrix.cells[2][2] +
-					matrix.cells[0][1] * matrix.cells[1][2] * matrix.cells[2][0] +
-					matrix.cells[0][2] * matrix.cells[1][0] * matrix.cells[2][1] -
-					matrix.cells[0][2] * matrix.cells[1][1] * matrix.cells[2][0] -
-					matrix.cells[0][1] * matrix.cells[1][0] * matrix.cells[2][2] -
-					matrix.cells[0][0] * matrix.cells[1][2] * matrix.cells[2][1];
+			std::optional<std::string_view> name = MapFind(layer_attributes, "_name");
+			if (name.has_value()) layer.name = *name;
 
-				// If the determinant is negative, the matrix has negative scaling.
-				if (determinant < 0.0f)
-				{
-					const uint32 old_model_index = instance.model_index;
-					const auto& model_map_iterator = inverse_model_map.find(old_model_index);
-					if (model_map_iterator == inverse_model_map.end())
-					{
-						const Model& old_model = models[old_model_index];
-						inverse_model_map[old_model_index] = instance.model_index = static_cast<uint32>(models.size());
+			std::optional<std::string_view> hidden = MapFind(layer_attributes, "_hidden");
+			if (hidden.has_value()) layer.hidden = (StringViewToData<uint8>(*hidden) != 0);
+		}
 
-						// When a transform has inverse scale it always has inverse scale on all 3 axes, so we can get away with reversing the ENTIRE new voxel data array.
-						std::vector<uint8> new_voxel_data{ old_model.voxel_data.rbegin(), old_model.voxel_data.rend() };
-						models.emplace_back(old_model.size, std::move(new_voxel_data));
-					}
-					else
-					{
-						instance.model_index = model_map_iterator->second;
-					}
+		Model::Size ReadModelSize(const Chunk& size_chunk, const ReaderSettings& reader_settings)
+		{
+			const void* data = size_chunk.content;
+			Model::Size size = ReadData<Model::Size>(data);
+			if (reader_settings.flipped_up_axis)
+			{
+				const uint32 old_y = size.y;
+				size.y = size.z;
+				size.z = old_y;
+			}
 
-					// Invert all rotation axes to avoid the negative scaling.
-					matrix.cells[0][0] = -matrix.cells[0][0];
-					matrix.cells[0][1] = -matrix.cells[0][1];
-					matrix.cells[0][2] = -matrix.cells[0][2];
+			return size;
+		}
 
-					matrix.cells[1][0] = -matrix.cells[1][0];
-					matrix.cells[1][1] = -matrix.cells[1][1];
-					matrix.cells[1][2] = -matrix.cells[1][2];
+		// Position of a packed XYZI voxel in the coordinate system of the reader settings, the size is the model's size after ReadModelSize().
+		void DecodeVoxelPosition(const uint32 voxel, const Model::Size& size, const ReaderSettings& reader_settings, uint32& x, uint32& y, uint32& z)
+		{
+			x = voxel & 0xFF;
 
-					matrix.cells[2][0] = -matrix.cells[2][0];
-					matrix.cells[2][1] = -matrix.cells[2][1];
-					matrix.cells[2][2] = -matrix.cells[2][2];
-				}
+			if (reader_settings.flipped_up_axis)
+			{
+				y = (voxel >> 16) & 0xFF;
+				z = (voxel >> 8) & 0xFF;
+			}
+			else
+			{
+				y = (voxel >> 8) & 0xFF;
+				z = (voxel >> 16) & 0xFF;
 			}
-		}
-	}
 
-	uint32 Scene::ParseSceneGraph(const void*& data, const ReaderSettings& reader_settings, const uint32 parent_transform_index)
-	{
-		SkipData(data, sizeof(uint32)); // Skip transform id.
-		const StringMap node_attributes = ReadDict(data); // Transform node's attributes (name, hidden).
+			x = (reader_settings.flipped_handedness ? size.x - 1 - x : x);
+			z = (reader_settings.flipped_up_axis ? size.z - 1 - z : z);
+		}
 
-		ReadData<uint32>(data); // Skip child node id.
-		assert(ReadData<sint32>(data) == -1 && "Invalid voxel file, reserved id in transform isn't -1!"); // Read reserved id.
+		void DecodeModel(const Chunk& size_chunk, const Chunk& voxel_chunk, const ReaderSettings& reader_settings, Model& model)
+		{
+			model.size = ReadModelSize(size_chunk, reader_settings);
 
-		SkipData(data, sizeof(uint32)); // Skip layer ID.
-		const uint32 frame_count = ReadData<uint32>(data);
-		assert(frame_count != 0 && "Invalid voxel file, voxel instance frame count is 0!"); // Double check frame count for validity, more than 1 frame isn't supported yet.
+			const uint32 voxel_count = model.size.x * model.size.y * model.size.z;
+			model.voxel_data.resize(voxel_count, 0);
 
-		StringMap transform_attributes;
-		for (usize i = 0; i < frame_count; i++)
-		{
-			const StringMap frame_attributes = ReadDict(data);
+			const uint32 stride_z = model.size.x * model.size.y;
 
-			if (i != 0) continue; // Skip processing all but the first frame.
+			const void* data = voxel_chunk.content;
+			const ArrayView<uint32> packed_voxel_data = ReadArray<uint32>(data);
+			for (const uint32 voxel : packed_voxel_data)
+			{
+				uint32 x;
+				uint32 y;
+				uint32 z;
+				DecodeVoxelPosition(voxel, model.size, reader_settings, x, y, z);
 
-			transform_attributes = frame_attributes;
+				const uint32 index = x + (y * model.size.x) + (z * stride_z);
+				model.voxel_data[index] = voxel >> 24;
+			}
 		}
 
-		Vector position{};
-		const std::string_view* translation = MapFind(transform_attributes, "_t");
-		if (translation != nullptr)
+		bool IsTransformIncluded(const Scene& scene, const Transform& transform, const ReaderSettings& reader_settings)
 		{
-			// Split the string into the xyz value strings.
-			const std::array<std::string_view, 3> translations = ParseViewVector(*translation);
+			if (reader_settings.skip_hidden_transforms && transform.hidden) return false;
 
-			// Technically the strings values are in sint32 format, but we can directly interpret them as float values as well.
-			position.x = StringViewToData<float>(translations.at(0));
-			position.y = StringViewToData<float>(translations.at(1));
-			position.z = StringViewToData<float>(translations.at(2));
-		}
+			const Layer* layer = (transform.layer_index < scene.layers.size()) ? &scene.layers[transform.layer_index] : nullptr;
+			if (reader_settings.skip_hidden_layers && layer != nullptr && layer->hidden) return false;
 
-		uint8 rotation = 0;
-		const std::string_view* rotation_view = MapFind(transform_attributes, "_r");
-		if (rotation_view != nullptr)
-		{
-			rotation = StringViewToData<uint8>(*rotation_view);
+			return !reader_settings.transform_filter || reader_settings.transform_filter(transform, layer);
 		}
 
-		const uint32 transform_index = static_cast<uint32>(transforms.size());
-		Transform& transform = transforms.emplace_back(position, rotation, reader_settings);
-		if (parent_transform_index != UINT32_MAX)
+		// Parses the nTRN node with the given id and all of its children, returns the index of the created transform (UINT32_MAX if it got filtered out).
+		uint32 ParseSceneGraph(Scene& scene, const ChunkIndex& index, const uint32 node_id, const ReaderSettings& reader_settings, const uint32 parent_transform_index = UINT32_MAX)
 		{
-			transform.matrix *= transforms[parent_transform_index].matrix;
-		}
-
-		const std::string_view* name = MapFind(node_attributes, "_name");
-		if (name != nullptr) transform.name = *name;
+			assert(node_id < index.nodes.size() && index.nodes[node_id].id == "nTRN" && "Invalid voxel file, expected a transform node!");
+			const void* data = index.nodes[node_id].content;
 
-		const std::string_view* hidden = MapFind(node_attributes, "_hidden");
-		if (hidden != nullptr) transform.hidden = (StringViewToData<uint8>(*hidden) != 0);
+			SkipData(data, sizeof(uint32)); // Skip transform id.
+			const StringMap node_attributes = ReadDict(data); // Transform node's attributes (name, hidden).
 
-		// Get the next chunk, guaranteed to be either nGRP or nSHP.
-		const ChunkHeader& next_node_chunk = ReadData<ChunkHeader>(data);
-		std::string_view next_chunk_id{ next_node_chunk.id, 4 };
-		if (next_chunk_id == "nGRP")
-		{
-			SkipData(data, sizeof(uint32)); // Skip group node id.
-			ReadDict(data); // Group node attributes, we can ignore these.
+			const uint32 child_node_id = ReadData<uint32>(data);
+			assert(ReadData<sint32>(data) == -1 && "Invalid voxel file, reserved id in transform isn't -1!"); // Read reserved id.
 
-			const usize group_index = groups.size();
-			const Group& group = groups.emplace_back(transform_index, ReadArray<uint32>(data));
+			const sint32 layer_id = ReadData<sint32>(data);
+			const uint32 frame_count = ReadData<uint32>(data);
+			assert(frame_count != 0 && "Invalid voxel file, voxel instance frame count is 0!"); // Double check frame count for validity, more than 1 frame isn't supported yet.
 
-			const usize children_count = group.child_transform_indices.size();
-			for (usize i = 0; i < children_count; i++)
+			StringMap transform_attributes;
+			for (usize i = 0; i < frame_count; i++)
 			{
-				SkipData(data, sizeof(ChunkHeader)); // Skip the next nTRN chunk header, since we know it'll be next.
-				groups[group_index].child_transform_indices[i] = ParseSceneGraph(data, reader_settings, transform_index);
-			}
+				const StringMap frame_attributes = ReadDict(data);
+
+				if (i != 0) continue; // Skip processing all but the first frame.
+
+				transform_attributes = frame_attributes;
+			}
+
+			Vector position{};
+			std::optional<std::string_view> translation = MapFind(transform_attributes, "_t");
+			if (translation.has_value())
+			{
+				// Split the string into the xyz value strings.
+				const std::array<std::string_view, 3> translations = ParseViewVector(*translation);
+
+				// Technically the strings values are in sint32 format, but we can directly interpret them as float values as well.
+				position.x = StringViewToData<float>(translations.at(0));
+				position.y = StringViewToData<float>(translations.at(1));
+				position.z = StringViewToData<float>(translations.at(2));
+			}
+
+			uint8 rotation = 0;
+			std::optional<std::string_view> rotation_view = MapFind(transform_attributes, "_r");
+			if (rotation_view.has_value())
+			{
+				rotation = StringViewToData<uint8>(*rotation_view);
+			}
+
+			const uint32 transform_index = static_cast<uint32>(scene.transforms.size());
+			Transform& transform = scene.transforms.emplace_back(position, rotation, reader_settings);
+			if (parent_transform_index != UINT32_MAX)
+			{
+				transform.matrix *= scene.transforms[parent_transform_index].matrix;
+			}
+
+			std::optional<std::string_view> name = MapFind(node_attributes, "_name");
+			if (name.has_value()) transform.name = *name;
+
+			std::optional<std::string_view> hidden = MapFind(node_attributes, "_hidden");
+			if (hidden.has_value()) transform.hidden = (StringViewToData<uint8>(*hidden) != 0);
+
+			transform.layer_index = (layer_id < 0) ? UINT32_MAX : static_cast<uint32>(layer_id);
+
+			// Filtered out transforms are removed again together with all of their children.
+			if (!IsTransformIncluded(scene, transform, reader_settings))
+			{
+				scene.transforms.pop_back();
+				return UINT32_MAX;
+			}
+
+			// The child node is guaranteed to be either nGRP or nSHP.
+			assert(child_node_id < index.nodes.size() && "Invalid voxel file, transform node has no child node!");
+			const Chunk& child_node = index.nodes[child_node_id];
+			data = child_node.content;
+			if (child_node.id == "nGRP")
+			{
+				SkipData(data, sizeof(uint32)); // Skip group node id.
+				ReadDict(data); // Group node attributes, we can ignore these.
+
+				const usize group_index = scene.groups.size();
+				scene.groups.emplace_back(transform_index, std::pmr::vector<uint32>{});
+
+				const ArrayView<uint32> children = ReadArray<uint32>(data);
+				scene.groups[group_index].child_transform_indices.reserve(children.size);
+				for (const uint32 child_id : children)
+				{
+					const uint32 child_transform_index = ParseSceneGraph(scene, index, child_id, reader_settings, transform_index);
+					if (child_transform_index != UINT32_MAX) scene.groups[group_index].child_transform_indices.push_back(child_transform_index);
+				}
+			}
+			else
+			{
+				SkipData(data, sizeof(uint32)); // Skip shape node id.
+				ReadDict(data); // Shape node attributes, we can ignore these.
+
+				const uint32 model_count = ReadData<uint32>(data);
+				assert(model_count != 0 && "Invalid voxel file, voxel model count is 0!");
+
+				// Only the first model is used, the others are animation frames.
+				const uint32 model_index = ReadData<uint32>(data);
+				scene.instances.emplace_back(transform_index, model_index);
+			}
+
+			return transform_index;
+		}
+
+		bool IsFiltering(const ReaderSettings& reader_settings)
+		{
+			return reader_settings.skip_hidden_transforms || reader_settings.skip_hidden_layers || reader_settings.transform_filter;
+		}
+
+		void ParsePalette(const Chunk& chunk, uint32 (&palette)[256])
+		{
+			// Read the 255 colors from the palette and copy them to the range [1 ~ 255] in the scene's palette (palette index 0 is skipped since it represents the absence of a voxel).
+			std::memcpy(&palette[1], chunk.content, 255 * sizeof(uint32));
+		}
+
+		void ParseIndexMap(const Chunk& chunk, Scene& scene)
+		{
+			assert(chunk.content_size >= 256 && "Invalid voxel file, IMAP chunk is too small!");
+			std::memcpy(scene.index_map, chunk.content, 256);
+			scene.has_index_map = true;
+		}
+
+		void BuildSceneGraph(Scene& scene, const ChunkIndex& index, const ReaderSettings& reader_settings)
+		{
+			if (index.nodes.empty()) return;
+
+			// Every transform node has a child node, so this is an upper bound of the transform count (growing would leave the old storage unused in an arena).
+			scene.transforms.reserve(index.nodes.size() / 2);
+
+			// The first nTRN node is the root transform, which we can skip processing, its child is the root nGRP node.
+			const void* root_data = index.nodes[0].content;
+			SkipData(root_data, sizeof(uint32)); // Skip the node id.
+			ReadDict(root_data); // Ignore the node attributes.
+			const uint32 root_group_id = ReadData<uint32>(root_data);
+
+			const void* group_data = index.nodes[root_group_id].content;
+			SkipData(group_data, sizeof(uint32)); // Skip over the node id.
+			ReadDict(group_data); // Ignore the node attributes.
+
+			// Get the root children, and for each child parse its children and so on.
+			const ArrayView<uint32> root_children = ReadArray<uint32>(group_data);
+			for (const uint32 child_id : root_children)
+			{
+				ParseSceneGraph(scene, index, child_id, reader_settings);
+			}
+		}
+
+		// Decodes a model, or copies it from the model cache if it's in there.
+		void LoadModel(const Chunk& size_chunk, const Chunk& voxel_chunk, const uint64 model_hash, const ReaderSettings& reader_settings, Model& model)
+		{
+			if (reader_settings.model_cache == nullptr)
+			{
+				DecodeModel(size_chunk, voxel_chunk, reader_settings, model);
+				return;
+			}
+
+			// The decoded voxel data depends on the coordinate system, so that's part of the key for the model cache.
+			const uint64 cache_seed = (reader_settings.flipped_handedness ? 0b01 : 0b00) | (reader_settings.flipped_up_axis ? 0b10 : 0b00);
+			const uint64 cache_key = MixHash(model_hash ^ cache_seed);
+
+			const std::shared_ptr<const Model> cached_model = reader_settings.model_cache->Find(cache_key);
+			if (cached_model != nullptr)
+			{
+				model = *cached_model;
+			}
+			else
+			{
+				DecodeModel(size_chunk, voxel_chunk, reader_settings, model);
+				reader_settings.model_cache->Insert(cache_key, model);
+			}
+		}
+
+		// Half voxel offset of a model with odd numbered scales along each axis, in the model's own orientation.
+		Vector HalfVoxelOffset(const Model::Size& size, const ReaderSettings& reader_settings)
+		{
+			// If the scale of the model is an odd number on any axis, add half a voxel as an offset to align the instances correctly.
+			Vector offset
+			{
+				size.x & 0b1 ? (reader_settings.voxel_scale.x / 2.0f) : 0.0f,
+				size.y & 0b1 ? (reader_settings.voxel_scale.y / 2.0f) : 0.0f,
+				size.z & 0b1 ? (reader_settings.voxel_scale.z / 2.0f) : 0.0f
+			};
+
+			// Make sure to flip the offset axes based on the coordinate system.
+			offset.x *= reader_settings.flipped_handedness ? -1.0f : 1.0f;
+			offset.z *= reader_settings.flipped_up_axis ? -1.0f : 1.0f;
+
+			return offset;
+		}
+
+		// Half voxel offset that aligns an instance of a model with odd numbered scales (see ReaderSettings::add_voxel_offsets), the matrix is the instance's transform matrix before avoiding negative scale.
+		Vector VoxelOffset(const Model::Size& size, const Matrix& matrix, const ReaderSettings& reader_settings)
+		{
+			Vector offset = HalfVoxelOffset(size, reader_settings);
+
+			// Multiply by the offset by the transform's matrix to correctly rotate the offset.
+			if (reader_settings.flipped_handedness || reader_settings.flipped_up_axis)
+			{
+				offset *= matrix;
+			}
+
+			return offset;
+		}
+
+		void AddVoxelOffset(Transform& transform, const Vector& offset)
+		{
+			Vector& position = transform.GetPosition();
+			position.x += offset.x;
+			position.y += offset.y;
+			position.z += offset.z;
+
+			transform.local_position.x += offset.x;
+			transform.local_position.y += offset.y;
+			transform.local_position.z += offset.z;
+		}
+
+		// Inverts all rotation axes to avoid negative scaling.
+		void InvertRotation(Matrix& matrix)
+		{
+			for (uint32 row = 0; row < 3; row++)
+			{
+				matrix.cells[row][0] = -matrix.cells[row][0];
+				matrix.cells[row][1] = -matrix.cells[row][1];
+				matrix.cells[row][2] = -matrix.cells[row][2];
+			}
+		}
+
+		// Applies the voxel offsets to the instances [first ~ last) and inverts the rotation of the ones with negative scale, flagging those in negative_scale.
+		void PrepareInstanceRange(Scene& scene, usize first, const usize last, const ReaderSettings& reader_settings, uint8* negative_scale)
+		{
+#ifdef VOXREADER_SSE2
+			// 4 instances at a time, with their matrices transposed so every register holds one cell of all 4 matrices.
+			for (; first + 4 <= last; first += 4)
+			{
+				Transform* transforms[4];
+				__m128 cells[3][4];
+				for (uint32 lane = 0; lane < 4; lane++)
+				{
+					transforms[lane] = &scene.transforms[scene.instances[first + lane].transform_index];
+					for (uint32 row = 0; row < 3; row++) cells[row][lane] = _mm_loadu_ps(transforms[lane]->matrix.cells[row]);
+				}
+				for (uint32 row = 0; row < 3; row++) _MM_TRANSPOSE4_PS(cells[row][0], cells[row][1], cells[row][2], cells[row][3]);
+
+				if (reader_settings.add_voxel_offsets)
+				{
+					alignas(16) float offsets[3][4];
+					for (uint32 lane = 0; lane < 4; lane++)
+					{
+						const Vector offset = HalfVoxelOffset(scene.models[scene.instances[first + lane].model_index].size, reader_settings);
+						offsets[0][lane] = offset.x;
+						offsets[1][lane] = offset.y;
+						offsets[2][lane] = offset.z;
+					}
+
+					// Same operation order as VoxelOffset(), so the results are identical.
+					if (reader_settings.flipped_handedness || reader_settings.flipped_up_axis)
+					{
+						const __m128 x = _mm_load_ps(offsets[0]);
+						const __m128 y = _mm_load_ps(offsets[1]);
+						const __m128 z = _mm_load_ps(offsets[2]);
+						for (uint32 column = 0; column < 3; column++)
+						{
+							__m128 result = _mm_add_ps(_mm_setzero_ps(), _mm_mul_ps(x, cells[0][column]));
+							result = _mm_add_ps(result, _mm_mul_ps(y, cells[1][column]));
+							result = _mm_add_ps(result, _mm_mul_ps(z, cells[2][column]));
+							_mm_store_ps(offsets[column], result);
+						}
+					}
+
+					for (uint32 lane = 0; lane < 4; lane++)
+					{
+						AddVoxelOffset(*transforms[lane], Vector{ offsets[0][lane], offsets[1][lane], offsets[2][lane] });
+					}
+				}
+
+				if (!reader_settings.avoid_negative_scale) continue;
+
+				__m128 determinant = _mm_mul_ps(_mm_mul_ps(cells[0][0], cells[1][1]), cells[2][2]);
+				determinant = _mm_add_ps(determinant, _mm_mul_ps(_mm_mul_ps(cells[0][1], cells[1][2]), cells[2][0]));
+				determinant = _mm_add_ps(determinant, _mm_mul_ps(_mm_mul_ps(cells[0][2], cells[1][0]), cells[2][1]));
+				determinant = _mm_sub_ps(determinant, _mm_mul_ps(_mm_mul_ps(cells[0][2], cells[1][1]), cells[2][0]));
+				determinant = _mm_sub_ps(determinant, _mm_mul_ps(_mm_mul_ps(cells[0][1], cells[1][0]), cells[2][2]));
+				determinant = _mm_sub_ps(determinant, _mm_mul_ps(_mm_mul_ps(cells[0][0], cells[1][2]), cells[2][1]));
+
+				const int negative_lanes = _mm_movemask_ps(_mm_cmplt_ps(determinant, _mm_setzero_ps()));
+				for (uint32 lane = 0; lane < 4; lane++)
+				{
+					if (((negative_lanes >> lane) & 0b1) == 0) continue;
+
+					negative_scale[first + lane] = 1;
+					InvertRotation(transforms[lane]->matrix);
+				}
+			}
+#endif
+			for (; first < last; first++)
+			{
+				const Instance& instance = scene.instances[first];
+				Transform& transform = scene.transforms[instance.transform_index];
+
+				if (reader_settings.add_voxel_offsets)
+				{
+					AddVoxelOffset(transform, VoxelOffset(scene.models[instance.model_index].size, transform.matrix, reader_settings));
+				}
+
+				if (!reader_settings.avoid_negative_scale) continue;
+
+				const Matrix& matrix = transform.matrix;
+				const float determinant = matrix.cells[0][0] * matrix.cells[1][1] * matrix.cells[2][2] +
+					matrix.cells[0][1] * matrix.cells[1][2] * matrix.cells[2][0] +
+					matrix.cells[0][2] * matrix.cells[1][0] * matrix.cells[2][1] -
+					matrix.cells[0][2] * matrix.cells[1][1] * matrix.cells[2][0] -
+					matrix.cells[0][1] * matrix.cells[1][0] * matrix.cells[2][2] -
+					matrix.cells[0][0] * matrix.cells[1][2] * matrix.cells[2][1];
+
+				// If the determinant is negative, the matrix has negative scaling.
+				if (determinant < 0.0f)
+				{
+					negative_scale[first] = 1;
+					InvertRotation(transform.matrix);
+				}
+			}
+		}
+
+		// Applies the voxel offsets and negative scale settings to the instances, this only needs the model sizes.
+		// Stores pairs of (original, mirrored) model indices in Scene::mirrored_models, the voxel data of the mirrored models is filled in by MirrorModels() once the original models are decoded.
+		void PrepareInstances(Scene& scene, const ReaderSettings& reader_settings)
+		{
+			if (!reader_settings.add_voxel_offsets && !reader_settings.avoid_negative_scale) return;
+
+			// Every instance has its own transform, so blocks of instances can be processed in parallel.
+			constexpr usize block_size = 1024;
+			const usize instance_count = scene.instances.size();
+			std::vector<uint8> negative_scale(instance_count, 0);
+			ParallelFor((instance_count + block_size - 1) / block_size, [&](const usize block)
+			{
+				const usize first = block * block_size;
+				PrepareInstanceRange(scene, first, std::min(first + block_size, instance_count), reader_settings, negative_scale.data());
+			});
+
+			if (!reader_settings.avoid_negative_scale) return;
+
+			// Mirrored model index of each model (UINT32_MAX if no instance uses it with negative scale), the mirrored models are added in the order of their first instance.
+			std::vector<uint32> mirrored_model_indices(scene.models.size(), UINT32_MAX);
+			usize mirrored_count = 0;
+			for (usize i = 0; i < instance_count; i++)
+			{
+				uint32& mirrored_model_index = mirrored_model_indices[scene.instances[i].model_index];
+				if (negative_scale[i] && mirrored_model_index == UINT32_MAX)
+				{
+					mirrored_model_index = 0;
+					mirrored_count++;
+				}
+			}
+			if (mirrored_count == 0) return;
+
+			// Presize the storage so it's only allocated once.
+			scene.models.reserve(scene.models.size() + mirrored_count);
+			scene.model_hashes.reserve(scene.model_hashes.size() + mirrored_count);
+			scene.mirrored_models.reserve(scene.mirrored_models.size() + mirrored_count);
+			std::fill(mirrored_model_indices.begin(), mirrored_model_indices.end(), UINT32_MAX);
+
+			for (usize i = 0; i < instance_count; i++)
+			{
+				if (!negative_scale[i]) continue;
+
+				Instance& instance = scene.instances[i];
+				const uint32 old_model_index = instance.model_index;
+				uint32& mirrored_model_index = mirrored_model_indices[old_model_index];
+				if (mirrored_model_index == UINT32_MAX)
+				{
+					mirrored_model_index = static_cast<uint32>(scene.models.size());
+					scene.mirrored_models.emplace_back(old_model_index, mirrored_model_index);
+
+					const Model::Size old_model_size = scene.models[old_model_index].size;
+					scene.models.emplace_back().size = old_model_size;
+
+					// Mirrored models get a hash derived from the original, so equal hashes still mean equal models.
+					scene.model_hashes.push_back(MixHash(scene.model_hashes[old_model_index] ^ 0x6D6972726F726564ull));
+				}
+
+				instance.model_index = mirrored_model_index;
+			}
+		}
+
+		// Copies the bytes of source in reverse order, 16 at a time.
+		void ReverseCopy(const uint8* source, uint8* destination, const usize count)
+		{
+			usize i = 0;
+#ifdef VOXREADER_SSE2
+			for (; i + 16 <= count; i += 16)
+			{
+				__m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + count - i - 16));
+#ifdef VOXREADER_SSSE3
+				block = _mm_shuffle_epi8(block, _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15));
+#else
+				// Reverse the 32-bit words, then the 16-bit halves of each word and then the bytes of each half.
+				block = _mm_shuffle_epi32(block, _MM_SHUFFLE(0, 1, 2, 3));
+				block = _mm_shufflelo_epi16(block, _MM_SHUFFLE(2, 3, 0, 1));
+				block = _mm_shufflehi_epi16(block, _MM_SHUFFLE(2, 3, 0, 1));
+				block = _mm_or_si128(_mm_slli_epi16(block, 8), _mm_srli_epi16(block, 8));
+#endif
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(destination + i), block);
+			}
+#endif
+			for (; i < count; i++)
+			{
+				destination[i] = source[count - 1 - i];
+			}
+		}
+
+		// Fills in the voxel data of the given (original, mirrored) model pairs.
+		template<typename Pairs>
+		void MirrorModels(Scene& scene, const Pairs& pairs)
+		{
+			// The storage is allocated up front on this thread (the memory resource doesn't have to be thread safe), only the copies happen in parallel.
+			for (const auto& [model_index, mirrored_model_index] : pairs)
+			{
+				Model& mirrored_model = scene.models[mirrored_model_index];
+				mirrored_model.size = scene.models[model_index].size;
+				mirrored_model.voxel_data.resize(scene.models[model_index].voxel_data.size());
+			}
+
+			// When a transform has inverse scale it always has inverse scale on all 3 axes, so we can get away with reversing the ENTIRE voxel data array.
+			ParallelFor(pairs.size(), [&](const usize i)
+			{
+				const std::pmr::vector<uint8>& voxel_data = scene.models[pairs[i].first].voxel_data;
+				ReverseCopy(voxel_data.data(), scene.models[pairs[i].second].voxel_data.data(), voxel_data.size());
+			});
+		}
+
+		// Reports to an asynchronous load (if there is one) unless it got cancelled.
+		template <typename Callback, typename... Arguments>
+		void Notify(AsyncSceneLoad::State* state, Callback AsyncSceneLoad::Callbacks::* callback, const Arguments&... arguments)
+		{
+			if (state == nullptr || !(state->callbacks.*callback)) return;
+
+			// No lock is held while calling back, so callbacks can cancel or drop the load themselves.
+			if (!state->cancelled) (state->callbacks.*callback)(arguments...);
+		}
+
+		bool IsCancelled(const AsyncSceneLoad::State* state)
+		{
+			return state != nullptr && state->cancelled;
+		}
+
+		// The memory resource for the scene's containers, the one from the settings takes priority over the scene's own arena (if any), falling back to the default resource.
+		std::pmr::memory_resource* SelectMemoryResource(const ReaderSettings& reader_settings, std::pmr::memory_resource* arena)
+		{
+			if (reader_settings.memory_resource != nullptr) return reader_settings.memory_resource;
+			return (arena != nullptr) ? arena : std::pmr::get_default_resource();
+		}
+
+		// Parses a file that is fully in memory, reporting to an asynchronous load if there is one. Returns false if the load got cancelled.
+		// Models of a previous version of the scene are reused by content hash when given (see Scene::Reload()), their voxel data is moved over instead of decoding it again.
+		bool LoadScene(Scene& scene, const void* data, const usize data_size, const ReaderSettings& reader_settings, AsyncSceneLoad::State* state, Scene* previous_scene = nullptr)
+		{
+			const ChunkIndex index = IndexChunks(data, data_size);
+
+			if (index.palette.content != nullptr)
+			{
+				ParsePalette(index.palette, scene.palette);
+			}
+			else
+			{
+				// If no palette was included in the file, copy the default palette.
+				std::memcpy(scene.palette, default_palette, sizeof(default_palette));
+			}
+			if (index.index_map.content != nullptr) ParseIndexMap(index.index_map, scene);
+			Notify(state, &AsyncSceneLoad::Callbacks::on_palette, scene);
+
+			for (const Chunk& chunk : index.materials)
+			{
+				ParseMaterial(chunk, scene.materials);
+			}
+			Notify(state, &AsyncSceneLoad::Callbacks::on_materials, scene);
+
+			if (IsCancelled(state)) return false;
+
+			// Layers have to be known before the scene graph is parsed to be able to filter on them.
+			for (const Chunk& chunk : index.layers)
+			{
+				ParseLayer(chunk, scene.layers);
+			}
+
+			BuildSceneGraph(scene, index, reader_settings);
+
+			scene.model_hashes.assign(index.model_hashes.begin(), index.model_hashes.end());
+
+			// Point instances of duplicate models to the first model with the same content, so each unique model is only decoded once.
+			std::vector<bool> duplicate_models(index.models.size(), false);
+			if (reader_settings.deduplicate_models)
+			{
+				std::vector<uint32> unique_model_indices(index.models.size());
+
+				std::unordered_map<uint64, std::vector<uint32>> models_by_hash;
+				for (uint32 i = 0; i < index.models.size(); i++)
+				{
+					unique_model_indices[i] = i;
+
+					std::vector<uint32>& candidates = models_by_hash[scene.model_hashes[i]];
+					for (const uint32 candidate : candidates)
+					{
+						// Compare the actual bytes to rule out hash collisions.
+						const Chunk& size = index.models[i].first;
+						const Chunk& voxels = index.models[i].second;
+						const Chunk& candidate_size = index.models[candidate].first;
+						const Chunk& candidate_voxels = index.models[candidate].second;
+						if (voxels.content_size == candidate_voxels.content_size &&
+							std::memcmp(size.content, candidate_size.content, sizeof(Model::Size)) == 0 &&
+							std::memcmp(voxels.content, candidate_voxels.content, voxels.content_size) == 0)
+						{
+							unique_model_indices[i] = candidate;
+							duplicate_models[i] = true;
+							break;
+						}
+					}
+
+					if (!duplicate_models[i]) candidates.push_back(i);
+				}
+
+				for (Instance& instance : scene.instances)
+				{
+					instance.model_index = unique_model_indices[instance.model_index];
+				}
+			}
+
+			// When filtering, only the models that are used by the remaining instances have to be decoded.
+			const bool filtering = IsFiltering(reader_settings) && !index.nodes.empty();
+			std::vector<bool> used_models(index.models.size(), !filtering);
+			for (usize i = 0; i < index.models.size(); i++)
+			{
+				if (duplicate_models[i]) used_models[i] = false;
+			}
+			for (const Instance& instance : scene.instances)
+			{
+				used_models[instance.model_index] = true;
+			}
+
+			// Skipped and duplicate models are left empty (size 0), so the model indices still match the ones in the file.
+			usize total_voxel_bytes = 0;
+			scene.models.resize(index.models.size());
+			for (usize i = 0; i < index.models.size(); i++)
+			{
+				scene.models[i].size = used_models[i] ? ReadModelSize(index.models[i].first, reader_settings) : Model::Size{ 0, 0, 0 };
+				if (used_models[i]) total_voxel_bytes += index.models[i].second.content_size;
+			}
+
+			// The scene graph is final once the instances are prepared, only the voxel data is missing after this.
+			PrepareInstances(scene, reader_settings);
+			Notify(state, &AsyncSceneLoad::Callbacks::on_scene_graph, scene);
+
+			// Loaded models of the previous scene by content hash, once a model is reused it's copied from its new location since its voxel data was moved.
+			std::unordered_map<uint64, std::pair<Model*, bool>> previous_models;
+			if (previous_scene != nullptr && previous_scene->model_hashes.size() == previous_scene->models.size())
+			{
+				for (usize i = 0; i < previous_scene->models.size(); i++)
+				{
+					Model& model = previous_scene->models[i];
+					if (!model.voxel_data.empty()) previous_models.try_emplace(previous_scene->model_hashes[i], &model, true);
+				}
+			}
+
+			const auto reuse_model = [&](const uint32 model_index)
+			{
+				const auto previous_model = previous_models.find(scene.model_hashes[model_index]);
+				if (previous_model == previous_models.end()) return false;
+
+				auto& [source, is_previous] = previous_model->second;
+				Model& model = scene.models[model_index];
+				if (std::memcmp(&source->size, &model.size, sizeof(Model::Size)) != 0) return false;
+
+				if (is_previous) model.voxel_data = std::move(source->voxel_data);
+				else model.voxel_data = source->voxel_data;
+
+				source = &model;
+				is_previous = false;
+				return true;
+			};
+
+			usize decoded_voxel_bytes = 0;
+			for (uint32 i = 0; i < index.models.size(); i++)
+			{
+				if (!used_models[i]) continue;
+				if (IsCancelled(state)) return false;
+
+				if (!reuse_model(i)) LoadModel(index.models[i].first, index.models[i].second, scene.model_hashes[i], reader_settings, scene.models[i]);
+
+				if (state != nullptr)
+				{
+					decoded_voxel_bytes += index.models[i].second.content_size;
+					state->progress = static_cast<float>(decoded_voxel_bytes) / static_cast<float>(total_voxel_bytes);
+				}
+				Notify(state, &AsyncSceneLoad::Callbacks::on_model, scene, i);
+			}
+
+			std::vector<std::pair<uint32, uint32>> mirrored_pairs;
+			for (const auto& [model_index, mirrored_model_index] : scene.mirrored_models)
+			{
+				if (!reuse_model(mirrored_model_index)) mirrored_pairs.emplace_back(model_index, mirrored_model_index);
+			}
+			MirrorModels(scene, mirrored_pairs);
+
+			for (const auto& [model_index, mirrored_model_index] : scene.mirrored_models)
+			{
+				Notify(state, &AsyncSceneLoad::Callbacks::on_model, scene, mirrored_model_index);
+			}
+
+			if (state != nullptr) state->progress = 1.0f;
+			return !IsCancelled(state);
+		}
+	}
+
+	Scene::Scene(const ReaderSettings& reader_settings) :
+		arena{ (reader_settings.use_arena && reader_settings.memory_resource == nullptr) ? std::make_shared<std::pmr::monotonic_buffer_resource>() : nullptr },
+		transforms{ SelectMemoryResource(reader_settings, arena.get()) },
+		models{ transforms.get_allocator() },
+		model_hashes{ transforms.get_allocator() },
+		mirrored_models{ transforms.get_allocator() },
+		instances{ transforms.get_allocator() },
+		groups{ transforms.get_allocator() },
+		layers{ transforms.get_allocator() } {}
+
+	Scene& Scene::operator=(const Scene& other)
+	{
+		if (this != &other) *this = Scene{ other };
+		return *this;
+	}
+
+	Scene& Scene::operator=(Scene&& other) noexcept
+	{
+		if (this != &other)
+		{
+			this->~Scene();
+			new (this) Scene{ std::move(other) };
+		}
+
+		return *this;
+	}
+
+	Scene::Scene(const void* data, const usize data_size, const ReaderSettings& reader_settings) : Scene{ reader_settings }
+	{
+		LoadScene(*this, data, data_size, reader_settings, nullptr);
+	}
+
+	namespace
+	{
+		// Compares the elements two versions of an array have in common and lists the ones that only exist in one of them.
+		template <typename Function>
+		void DiffIndices(const usize previous_count, const usize count, SceneChanges::IndexChanges& changes, const Function& is_modified)
+		{
+			for (uint32 i = 0; i < std::min(previous_count, count); i++)
+			{
+				if (is_modified(i)) changes.modified.push_back(i);
+			}
+			for (usize i = previous_count; i < count; i++) changes.added.push_back(static_cast<uint32>(i));
+			for (usize i = count; i < previous_count; i++) changes.removed.push_back(static_cast<uint32>(i));
+		}
+	}
+
+	SceneChanges Scene::Reload(const void* data, const usize data_size, const ReaderSettings& reader_settings)
+	{
+		// The voxel data of reused models is moved to the reloaded scene, so remember which models were loaded.
+		std::vector<bool> loaded_models(models.size());
+		for (usize i = 0; i < models.size(); i++) loaded_models[i] = !models[i].voxel_data.empty();
+
+		Scene reloaded{ reader_settings };
+		LoadScene(reloaded, data, data_size, reader_settings, nullptr, this);
+
+		SceneChanges changes;
+		const bool has_hashes = (model_hashes.size() == models.size());
+		DiffIndices(models.size(), reloaded.models.size(), changes.models, [&](const uint32 i)
+		{
+			return !has_hashes || model_hashes[i] != reloaded.model_hashes[i] || loaded_models[i] != !reloaded.models[i].voxel_data.empty();
+		});
+		DiffIndices(transforms.size(), reloaded.transforms.size(), changes.transforms, [&](const uint32 i)
+		{
+			const Transform& a = transforms[i];
+			const Transform& b = reloaded.transforms[i];
+			return a.name != b.name || std::memcmp(&a.matrix, &b.matrix, sizeof(Matrix)) != 0 || a.hidden != b.hidden || a.layer_index != b.layer_index;
+		});
+		DiffIndices(instances.size(), reloaded.instances.size(), changes.instances, [&](const uint32 i)
+		{
+			return instances[i].transform_index != reloaded.instances[i].transform_index || instances[i].model_index != reloaded.instances[i].model_index;
+		});
+		DiffIndices(layers.size(), reloaded.layers.size(), changes.layers, [&](const uint32 i)
+		{
+			return layers[i].name != reloaded.layers[i].name || layers[i].hidden != reloaded.layers[i].hidden;
+		});
+		DiffIndices(256, 256, changes.palette, [&](const uint32 i) { return palette[i] != reloaded.palette[i]; });
+		DiffIndices(256, 256, changes.materials, [&](const uint32 i) { return !MaterialsEqual(materials[i], reloaded.materials[i]); });
+
+		*this = std::move(reloaded);
+		return changes;
+	}
+
+	Scene::Scene(std::istream& stream, const ReaderSettings& reader_settings) : Scene{ [&stream](void* buffer, const usize byte_count)
+	{
+		stream.read(static_cast<char*>(buffer), static_cast<std::streamsize>(byte_count));
+		return static_cast<usize>(stream.gcount());
+	}, reader_settings } {}
+
+	Scene::Scene(const ReadCallback& read, const ReaderSettings& reader_settings) : Scene{ reader_settings }
+	{
+		const auto read_exact = [&read](void* buffer, const usize byte_count)
+		{
+			usize total_read = 0;
+			while (total_read < byte_count)
+			{
+				const usize bytes_read = read(static_cast<uint8*>(buffer) + total_read, byte_count - total_read);
+				if (bytes_read == 0) break;
+
+				total_read += bytes_read;
+			}
+
+			return total_read == byte_count;
+		};
+
+		VoxHeader file_header;
+		const bool has_header = read_exact(&file_header, sizeof(VoxHeader));
+		assert(has_header && std::string_view(file_header.id, 4) == "VOX " && "Voxel file is invalid, header not valid!"); // Check that the file is valid using the header id.
+
+		ChunkHeader root_header;
+		if (!has_header || !read_exact(&root_header, sizeof(ChunkHeader))) return; // Skip the root chunk (only has a header).
+
+		// Scene graph nodes are kept until the end (they're small) since the layers they use come after them, all other chunks are processed right away using a single reused buffer.
+		ChunkIndex index;
+		std::vector<std::vector<uint8>> node_storage;
+		std::vector<uint8> chunk_buffer;
+		Model::Size model_size{};
+		bool has_palette = false;
+
+		std::unordered_map<uint64, std::vector<uint32>> models_by_hash; // Unused if reader_settings.deduplicate_models == false.
+		std::vector<uint32> unique_model_indices;
+
+		ChunkHeader header;
+		while (read_exact(&header, sizeof(ChunkHeader)))
+		{
+			const std::string_view id{ header.id, 4 };
+			const bool is_node = (id == "nTRN" || id == "nGRP" || id == "nSHP");
+
+			std::vector<uint8>& content = is_node ? node_storage.emplace_back() : chunk_buffer;
+			content.resize(header.content_size);
+			if (!read_exact(content.data(), header.content_size))
+			{
+				assert(false && "Invalid voxel file, chunk is cut off!");
+				break;
+			}
+
+			const Chunk chunk{ id, content.data(), header.content_size };
+			if (id == "SIZE")
+			{
+				std::memcpy(&model_size, content.data(), sizeof(Model::Size));
+			}
+			else if (id == "XYZI")
+			{
+				const uint32 model_index = static_cast<uint32>(models.size());
+				const Chunk size_chunk{ "SIZE", &model_size, sizeof(Model::Size) };
+
+				const uint64 model_hash = HashBytes(chunk.content, chunk.content_size, HashBytes(&model_size, sizeof(Model::Size)));
+				model_hashes.push_back(model_hash);
+
+				Model& model = models.emplace_back();
+				LoadModel(size_chunk, chunk, model_hash, reader_settings, model);
+
+				unique_model_indices.push_back(model_index);
+				if (reader_settings.deduplicate_models)
+				{
+					// The raw data isn't kept around, so compare the decoded models to rule out hash collisions.
+					std::vector<uint32>& candidates = models_by_hash[model_hash];
+					for (const uint32 candidate : candidates)
+					{
+						const Model& candidate_model = models[candidate];
+						if (std::memcmp(&candidate_model.size, &model.size, sizeof(Model::Size)) == 0 && candidate_model.voxel_data == model.voxel_data)
+						{
+							unique_model_indices[model_index] = candidate;
+							// Release the buffer through the model's own allocator, assigning a default constructed model wouldn't free anything with a custom memory resource.
+							model.voxel_data = std::pmr::vector<uint8>{ model.voxel_data.get_allocator() };
+							model.size = Model::Size{ 0, 0, 0 };
+							break;
+						}
+					}
+
+					if (unique_model_indices[model_index] == model_index) candidates.push_back(model_index);
+				}
+			}
+			else if (is_node)
+			{
+				const void* node_data = chunk.content;
+				const uint32 node_id = ReadData<uint32>(node_data);
+
+				if (node_id >= index.nodes.size()) index.nodes.resize(node_id + 1);
+				index.nodes[node_id] = Chunk{ (id == "nTRN") ? "nTRN" : (id == "nGRP") ? "nGRP" : "nSHP", chunk.content, chunk.content_size };
+			}
+			else if (id == "LAYR")
+			{
+				ParseLayer(chunk, layers);
+			}
+			else if (id == "MATL")
+			{
+				ParseMaterial(chunk, materials);
+			}
+			else if (id == "RGBA")
+			{
+				ParsePalette(chunk, palette);
+				has_palette = true;
+			}
+			else if (id == "IMAP")
+			{
+				ParseIndexMap(chunk, *this);
+			}
+		}
+
+		if (!has_palette)
+		{
+			// If no palette was included in the file, copy the default palette.
+			std::memcpy(palette, default_palette, sizeof(default_palette));
+		}
+
+		BuildSceneGraph(*this, index, reader_settings);
+
+		for (Instance& instance : instances)
+		{
+			instance.model_index = unique_model_indices[instance.model_index];
+		}
+
+		// When filtering, the models had to be decoded before the layers were known, so the unused ones are released afterwards.
+		if (IsFiltering(reader_settings) && !index.nodes.empty())
+		{
+			std::vector<bool> used_models(models.size(), false);
+			for (const Instance& instance : instances)
+			{
+				used_models[instance.model_index] = true;
+			}
+
+			for (usize i = 0; i < models.size(); i++)
+			{
+				if (used_models[i]) continue;
+
+				models[i].voxel_data = std::pmr::vector<uint8>{ models[i].voxel_data.get_allocator() };
+				models[i].size = Model::Size{ 0, 0, 0 };
+			}
+		}
+
+		PrepareInstances(*this, reader_settings);
+		MirrorModels(*this, mirrored_models);
+	}
+
+	namespace
+	{
+		template <typename Type>
+		void WriteData(std::vector<uint8>& buffer, const Type& data)
+		{
+			const usize offset = buffer.size();
+			buffer.resize(offset + sizeof(Type));
+			std::memcpy(buffer.data() + offset, &data, sizeof(Type));
+		}
+
+		void WriteString(std::vector<uint8>& buffer, const std::string_view& string)
+		{
+			WriteData(buffer, static_cast<uint32>(string.size()));
+			buffer.insert(buffer.end(), string.begin(), string.end());
+		}
+
+		using StringList = std::vector<std::pair<std::string_view, std::string>>;
+
+		void WriteDict(std::vector<uint8>& buffer, const StringList& dict)
+		{
+			WriteData(buffer, static_cast<uint32>(dict.size()));
+			for (const auto& [key, value] : dict)
+			{
+				WriteString(buffer, key);
+				WriteString(buffer, value);
+			}
+		}
+
+		void WriteChunkHeader(std::vector<uint8>& buffer, const std::string_view& id, const uint32 content_size, const uint32 children_size)
+		{
+			buffer.insert(buffer.end(), id.begin(), id.end());
+			WriteData(buffer, content_size);
+			WriteData(buffer, children_size);
+		}
+
+		// Writes the header of a chunk without children, returns its offset so EndChunk() can fill in the content size once the content is written.
+		usize BeginChunk(std::vector<uint8>& buffer, const std::string_view& id)
+		{
+			const usize header_offset = buffer.size();
+			WriteChunkHeader(buffer, id, 0, 0);
+			return header_offset;
+		}
+
+		void EndChunk(std::vector<uint8>& buffer, const usize header_offset)
+		{
+			const uint32 content_size = static_cast<uint32>(buffer.size() - header_offset - sizeof(ChunkHeader));
+			std::memcpy(buffer.data() + header_offset + 4, &content_size, sizeof(uint32));
+		}
+
+		// Shortest representation that reads back as the same float.
+		std::string FloatToString(const float value)
+		{
+			char string[32];
+			const std::to_chars_result result = std::to_chars(std::begin(string), std::end(string), value);
+			return { string, result.ptr };
+		}
+
+		// Inverse of the rotation decoding in the Transform constructor, the matrix has to be a (signed) permutation matrix.
+		uint8 EncodeRotation(const Matrix& matrix)
+		{
+			uint32 rows[3];
+			uint8 rotation = 0;
+			for (uint32 column = 0; column < 3; column++)
+			{
+				rows[column] = 0;
+				for (uint32 row = 1; row < 3; row++)
+				{
+					if (std::abs(matrix.cells[row][column]) > std::abs(matrix.cells[rows[column]][column])) rows[column] = row;
+				}
+
+				if (matrix.cells[rows[column]][column] < 0.0f) rotation |= static_cast<uint8>(1 << (4 + column));
+			}
+			assert(rows[0] != rows[1] && rows[0] != rows[2] && rows[1] != rows[2] && "Transform rotations have to be multiples of 90 degrees to be written!");
+
+			return static_cast<uint8>(rotation | rows[0] | (rows[1] << 2));
+		}
+
+		void WriteMaterial(std::vector<uint8>& buffer, const uint32 material_id, const Material& material)
+		{
+			const usize header_offset = BeginChunk(buffer, "MATL");
+			WriteData(buffer, material_id);
+
+			// Always written using the names since version 200, with the ranges converted back to the ones ParseMaterial() compensates for.
+			WriteDict(buffer, StringList
+			{
+				{ "_type", std::string{ FindMappingName(type_mapping, material.type) } },
+				{ "_media_type", std::string{ FindMappingName(media_type_mapping, material.media_type) } },
+				{ "_rough", FloatToString(material.roughness / 100.0f) },
+				{ "_ri", FloatToString(material.ior) },
+				{ "_sp", FloatToString(material.specular) },
+				{ "_emit", FloatToString(material.emission / 100.0f) },
+				{ "_flux", std::to_string(material.power) },
+				{ "_ldr", FloatToString(material.ldr / 100.0f) },
+				{ "_metal", FloatToString(material.metallic / 100.0f) },
+				{ "_trans", FloatToString(material.transparency / 100.0f) },
+				{ "_d", FloatToString(material.density / 1000.0f) },
+				{ "_g", FloatToString(material.phase) }
+			});
+
+			EndChunk(buffer, header_offset);
+		}
+
+		// Packs the voxels of a model into XYZI format in the file's coordinate system (inverse of DecodeModel()), the voxel pointer must have room for all non empty voxels.
+		void EncodeModel(const Model& model, const ReaderSettings& reader_settings, uint8* voxels)
+		{
+			const uint32 stride_z = model.size.x * model.size.y;
+			for (uint32 z = 0; z < model.size.z; z++)
+			{
+				for (uint32 y = 0; y < model.size.y; y++)
+				{
+					const uint8* row = model.voxel_data.data() + y * model.size.x + z * stride_z;
+					for (uint32 x = 0; x < model.size.x; x++)
+					{
+						if (row[x] == 0) continue;
+
+						const uint32 file_x = reader_settings.flipped_handedness ? model.size.x - 1 - x : x;
+						uint32 file_y = y;
+						uint32 file_z = z;
+						if (reader_settings.flipped_up_axis)
+						{
+							file_y = model.size.z - 1 - z;
+							file_z = y;
+						}
+
+						const uint32 voxel = file_x | (file_y << 8) | (file_z << 16) | (static_cast<uint32>(row[x]) << 24);
+						std::memcpy(voxels, &voxel, sizeof(uint32));
+						voxels += sizeof(uint32);
+					}
+				}
+			}
+		}
+	}
+
+	void Scene::Write(std::ostream& stream, const ReaderSettings& reader_settings) const
+	{
+		Write([&stream](const void* data, const usize byte_count)
+		{
+			stream.write(static_cast<const char*>(data), static_cast<std::streamsize>(byte_count));
+		}, reader_settings);
+	}
+
+	void Scene::Write(const WriteCallback& write, const ReaderSettings& reader_settings) const
+	{
+		// Instances of mirrored models are written as instances of the original model with negative scale again.
+		std::vector<uint32> mirror_sources(models.size(), UINT32_MAX);
+		for (const auto& [model_index, mirrored_model_index] : mirrored_models)
+		{
+			mirror_sources[mirrored_model_index] = model_index;
+		}
+
+		std::vector<bool> used_models(models.size(), false);
+		for (const Instance& instance : instances)
+		{
+			used_models[instance.model_index] = true;
+		}
+
+		// Mirrored models and empty models (skipped or duplicate ones) that aren't used are left out of the file, which changes the model indices.
+		std::vector<uint32> file_model_indices(models.size(), UINT32_MAX);
+		std::vector<uint32> written_models;
+		for (uint32 i = 0; i < models.size(); i++)
+		{
+			const Model::Size& size = models[i].size;
+			if (mirror_sources[i] != UINT32_MAX || (size.x * size.y * size.z == 0 && !used_models[i])) continue;
+			assert(size.x <= 256 && size.y <= 256 && size.z <= 256 && "Models can't be larger than 256 voxels on any axis!");
+
+			file_model_indices[i] = static_cast<uint32>(written_models.size());
+			written_models.push_back(i);
+		}
+
+		for (uint32 i = 0; i < models.size(); i++)
+		{
+			if (mirror_sources[i] != UINT32_MAX) file_model_indices[i] = file_model_indices[mirror_sources[i]];
+		}
+
+		// Count the voxels first, so all models can be encoded in parallel straight into their place in the file.
+		std::vector<uint32> voxel_counts(written_models.size());
+		ParallelFor(written_models.size(), [&](const usize i)
+		{
+			const std::pmr::vector<uint8>& voxel_data = models[written_models[i]].voxel_data;
+			voxel_counts[i] = static_cast<uint32>(voxel_data.size() - static_cast<usize>(std::count(voxel_data.begin(), voxel_data.end(), uint8{ 0 })));
+		});
+
+		constexpr usize size_chunk_size = sizeof(ChunkHeader) + sizeof(Model::Size);
+		std::vector<usize> model_offsets(written_models.size());
+		usize model_bytes = 0;
+		for (usize i = 0; i < written_models.size(); i++)
+		{
+			model_offsets[i] = model_bytes;
+			model_bytes += size_chunk_size + sizeof(ChunkHeader) + sizeof(uint32) + voxel_counts[i] * sizeof(uint32);
+		}
+
+		// Undo the voxel offsets and mirroring on the world matrices, and convert them back to the file's coordinate system.
+		std::vector<Matrix> world_matrices(transforms.size());
+		for (usize i = 0; i < transforms.size(); i++)
+		{
+			world_matrices[i] = transforms[i].matrix;
+		}
+
+		for (const Instance& instance : instances)
+		{
+			Matrix& matrix = world_matrices[instance.transform_index];
+			if (mirror_sources[instance.model_index] != UINT32_MAX)
+			{
+				for (usize row = 0; row < 3; row++)
+				{
+					for (usize column = 0; column < 3; column++)
+					{
+						matrix.cells[row][column] = -matrix.cells[row][column];
+					}
+				}
+			}
+
+			if (reader_settings.add_voxel_offsets)
+			{
+				const Vector offset = VoxelOffset(models[instance.model_index].size, matrix, reader_settings);
+				matrix.cells[3][0] -= offset.x;
+				matrix.cells[3][1] -= offset.y;
+				matrix.cells[3][2] -= offset.z;
+			}
+		}
+
+		if (reader_settings.flipped_handedness || reader_settings.flipped_up_axis)
+		{
+			for (Matrix& matrix : world_matrices)
+			{
+				matrix = reader_settings.inverse_coord_system_matrix * matrix * reader_settings.coord_system_matrix;
+			}
+		}
+
+		std::vector<uint32> parent_indices(transforms.size(), UINT32_MAX);
+		std::vector<const Group*> transform_groups(transforms.size(), nullptr);
+		std::vector<const Instance*> transform_instances(transforms.size(), nullptr);
+		for (const Group& group : groups)
+		{
+			transform_groups[group.transform_index] = &group;
+			for (const uint32 child_transform_index : group.child_transform_indices)
+			{
+				parent_indices[child_transform_index] = group.transform_index;
+			}
+		}
+
+		for (const Instance& instance : instances)
+		{
+			transform_instances[instance.transform_index] = &instance;
+		}
+
+		// Everything after the models is small, so it's written serially. Node ids: 0 and 1 for the root transform and group, 2 + 2 * i for transform i and 3 + 2 * i for its child node.
+		std::vector<uint8> scene_data;
+		if (!transforms.empty())
+		{
+			std::vector<uint32> root_children;
+			for (uint32 i = 0; i < transforms.size(); i++)
+			{
+				if (parent_indices[i] == UINT32_MAX) root_children.push_back(2 + 2 * i);
+			}
+
+			usize header_offset = BeginChunk(scene_data, "nTRN");
+			WriteData<uint32>(scene_data, 0);
+			WriteDict(scene_data, {});
+			WriteData<uint32>(scene_data, 1);
+			WriteData<sint32>(scene_data, -1);
+			WriteData<sint32>(scene_data, -1);
+			WriteData<uint32>(scene_data, 1);
+			WriteDict(scene_data, {});
+			EndChunk(scene_data, header_offset);
+
+			header_offset = BeginChunk(scene_data, "nGRP");
+			WriteData<uint32>(scene_data, 1);
+			WriteDict(scene_data, {});
+			WriteData(scene_data, static_cast<uint32>(root_children.size()));
+			for (const uint32 child_id : root_children) WriteData(scene_data, child_id);
+			EndChunk(scene_data, header_offset);
+
+			for (uint32 i = 0; i < transforms.size(); i++)
+			{
+				const Transform& transform = transforms[i];
+
+				Matrix local_matrix = world_matrices[i];
+				if (parent_indices[i] != UINT32_MAX) local_matrix *= InverseAffine(world_matrices[parent_indices[i]]);
+
+				StringList node_attributes;
+				if (!transform.name.empty()) node_attributes.emplace_back("_name", transform.name);
+				if (transform.hidden) node_attributes.emplace_back("_hidden", "1");
+
+				// The voxel scale is applied in the file's coordinate system, before the coordinate system conversion.
+				const float voxel_scale[3]{ reader_settings.voxel_scale.x, reader_settings.voxel_scale.y, reader_settings.voxel_scale.z };
+				std::string translation;
+				for (usize axis = 0; axis < 3; axis++)
+				{
+					if (axis != 0) translation += ' ';
+					translation += std::to_string(std::lround(local_matrix.cells[3][axis] / voxel_scale[axis]));
+				}
+
+				StringList frame_attributes;
+				const uint8 rotation = EncodeRotation(local_matrix);
+				if (rotation != 0b0000100) frame_attributes.emplace_back("_r", std::to_string(rotation)); // 0b0000100 is the identity rotation.
+				frame_attributes.emplace_back("_t", std::move(translation));
+
+				header_offset = BeginChunk(scene_data, "nTRN");
+				WriteData(scene_data, 2 + 2 * i);
+				WriteDict(scene_data, node_attributes);
+				WriteData(scene_data, 3 + 2 * i);
+				WriteData<sint32>(scene_data, -1);
+				WriteData<sint32>(scene_data, transform.layer_index == UINT32_MAX ? -1 : static_cast<sint32>(transform.layer_index));
+				WriteData<uint32>(scene_data, 1);
+				WriteDict(scene_data, frame_attributes);
+				EndChunk(scene_data, header_offset);
+
+				// Transforms without a group or instance (only possible if the scene was edited) get an empty group.
+				if (transform_instances[i] != nullptr)
+				{
+					header_offset = BeginChunk(scene_data, "nSHP");
+					WriteData(scene_data, 3 + 2 * i);
+					WriteDict(scene_data, {});
+					WriteData<uint32>(scene_data, 1);
+					WriteData(scene_data, file_model_indices[transform_instances[i]->model_index]);
+					WriteDict(scene_data, {});
+					EndChunk(scene_data, header_offset);
+				}
+				else
+				{
+					header_offset = BeginChunk(scene_data, "nGRP");
+					WriteData(scene_data, 3 + 2 * i);
+					WriteDict(scene_data, {});
+
+					const Group* group = transform_groups[i];
+					WriteData(scene_data, static_cast<uint32>(group != nullptr ? group->child_transform_indices.size() : 0));
+					if (group != nullptr)
+					{
+						for (const uint32 child_transform_index : group->child_transform_indices) WriteData(scene_data, 2 + 2 * child_transform_index);
+					}
+					EndChunk(scene_data, header_offset);
+				}
+			}
+		}
+
+		for (uint32 i = 0; i < layers.size(); i++)
+		{
+			StringList layer_attributes;
+			if (!layers[i].name.empty()) layer_attributes.emplace_back("_name", layers[i].name);
+			if (layers[i].hidden) layer_attributes.emplace_back("_hidden", "1");
+
+			const usize header_offset = BeginChunk(scene_data, "LAYR");
+			WriteData(scene_data, i);
+			WriteDict(scene_data, layer_attributes);
+			WriteData<sint32>(scene_data, -1);
+			EndChunk(scene_data, header_offset);
+		}
+
+		// The file stores the palette colors [1 ~ 255] followed by one unused color.
+		const usize palette_offset = BeginChunk(scene_data, "RGBA");
+		scene_data.insert(scene_data.end(), reinterpret_cast<const uint8*>(&palette[1]), reinterpret_cast<const uint8*>(&palette[256]));
+		WriteData(scene_data, palette[0]);
+		EndChunk(scene_data, palette_offset);
+
+		if (has_index_map)
+		{
+			const usize index_map_offset = BeginChunk(scene_data, "IMAP");
+			scene_data.insert(scene_data.end(), std::begin(index_map), std::end(index_map));
+			EndChunk(scene_data, index_map_offset);
+		}
+
+		for (uint32 i = 0; i < 256; i++)
+		{
+			WriteMaterial(scene_data, i, materials[i]);
+		}
+
+		// Assemble the file in a single presized buffer.
+		std::vector<uint8> file_data;
+		file_data.reserve(sizeof(VoxHeader) + sizeof(ChunkHeader) + model_bytes + scene_data.size());
+		file_data.insert(file_data.end(), { 'V', 'O', 'X', ' ' });
+		WriteData<uint32>(file_data, 200);
+		WriteChunkHeader(file_data, "MAIN", 0, static_cast<uint32>(model_bytes + scene_data.size()));
+
+		const usize models_start = file_data.size();
+		file_data.resize(models_start + model_bytes);
+		file_data.insert(file_data.end(), scene_data.begin(), scene_data.end());
+
+		ParallelFor(written_models.size(), [&](const usize i)
+		{
+			const Model& model = models[written_models[i]];
+			const uint32 voxel_count = voxel_counts[i];
+
+			Model::Size file_size = model.size;
+			if (reader_settings.flipped_up_axis) std::swap(file_size.y, file_size.z);
+
+			std::vector<uint8> chunk_headers;
+			chunk_headers.reserve(size_chunk_size + sizeof(ChunkHeader) + sizeof(uint32));
+			WriteChunkHeader(chunk_headers, "SIZE", sizeof(Model::Size), 0);
+			WriteData(chunk_headers, file_size);
+			WriteChunkHeader(chunk_headers, "XYZI", static_cast<uint32>(sizeof(uint32) + voxel_count * sizeof(uint32)), 0);
+			WriteData(chunk_headers, voxel_count);
+
+			uint8* destination = file_data.data() + models_start + model_offsets[i];
+			std::memcpy(destination, chunk_headers.data(), chunk_headers.size());
+			EncodeModel(model, reader_settings, destination + chunk_headers.size());
+		});
+
+		write(file_data.data(), file_data.size());
+	}
+
+	namespace
+	{
+		// Heap memory of a string, strings that fit in the small string buffer don't use any.
+		usize StringHeapSize(const std::pmr::string& string)
+		{
+			const usize small_capacity = std::pmr::string{}.capacity();
+			return (string.capacity() > small_capacity) ? string.capacity() + 1 : 0;
+		}
+	}
+
+	MemoryUsage Scene::GetMemoryUsage() const
+	{
+		MemoryUsage usage;
+
+		for (const Model& model : models) usage.voxel_data += model.voxel_data.capacity();
+		usage.models = models.capacity() * sizeof(Model) + model_hashes.capacity() * sizeof(uint64) + mirrored_models.capacity() * sizeof(std::pair<uint32, uint32>);
+
+		usage.transforms = transforms.capacity() * sizeof(Transform);
+		for (const Transform& transform : transforms) usage.names += StringHeapSize(transform.name);
+		for (const Layer& layer : layers) usage.names += StringHeapSize(layer.name);
+
+		usage.groups = groups.capacity() * sizeof(Group);
+		for (const Group& group : groups) usage.groups += group.child_transform_indices.capacity() * sizeof(uint32);
+
+		usage.instances = instances.capacity() * sizeof(Instance);
+		usage.other = layers.capacity() * sizeof(Layer) + sizeof(Scene);
+
+		return usage;
+	}
+
+	MemoryEstimate Scene::EstimateMemoryUsage(const void* data, const usize data_size)
+	{
+		const void* const data_end = static_cast<const uint8*>(data) + data_size;
+
+		const VoxHeader& file_header = ReadData<VoxHeader>(data);
+		assert(std::string_view(file_header.id, 4) == "VOX " && "Voxel file is invalid, header not valid!");
+
+		MemoryEstimate estimate;
+		usize model_count = 0;
+		usize transform_node_count = 0;
+		usize group_node_count = 0;
+		usize shape_node_count = 0;
+		usize layer_count = 0;
+
+		SkipData(data, sizeof(ChunkHeader)); // Skip the root chunk (only has a header).
+		while (data < data_end)
+		{
+			const ChunkHeader& header = ReadData<ChunkHeader>(data);
+			const std::string_view id{ header.id, 4 };
+
+			if (id == "SIZE")
+			{
+				const Model::Size& size = *static_cast<const Model::Size*>(data);
+				estimate.usage.voxel_data += static_cast<usize>(size.x) * size.y * size.z;
+				model_count++;
+			}
+			else if (id == "XYZI")
+			{
+				estimate.voxel_count += *static_cast<const uint32*>(data);
+			}
+			else if (id == "nTRN")
+			{
+				transform_node_count++;
+			}
+			else if (id == "nGRP")
+			{
+				group_node_count++;
+			}
+			else if (id == "nSHP")
+			{
+				shape_node_count++;
+			}
+			else if (id == "LAYR")
+			{
+				layer_count++;
+			}
+
+			SkipData(data, header.content_size);
+		}
+
+		// The root transform and group aren't stored in the scene, at most all other transforms are the child of a group.
+		const usize transform_count = (transform_node_count > 0) ? transform_node_count - 1 : 0;
+		const usize group_count = (group_node_count > 0) ? group_node_count - 1 : 0;
+
+		estimate.usage.models = model_count * (sizeof(Model) + sizeof(uint64));
+		estimate.usage.transforms = std::max(transform_count, (transform_node_count + group_node_count + shape_node_count) / 2) * sizeof(Transform); // Room is reserved for half of the nodes.
+		estimate.usage.groups = group_count * sizeof(Group) + transform_count * sizeof(uint32);
+		estimate.usage.instances = shape_node_count * sizeof(Instance);
+		estimate.usage.other = layer_count * sizeof(Layer) + sizeof(Scene);
+
+		return estimate;
+	}
+
+	AsyncSceneLoad::AsyncSceneLoad(std::vector<uint8> file_data, const ReaderSettings& reader_settings, Callbacks callbacks) : state{ std::make_shared<State>() }
+	{
+		state->file_data = std::move(file_data);
+		state->reader_settings = reader_settings;
+		state->callbacks = std::move(callbacks);
+		state->scene = Scene{ reader_settings };
+
+		// The thread keeps the state alive, so the load can be dropped without waiting for it.
+		std::thread{ [state = state]()
+		{
+			LoadScene(state->scene, state->file_data.data(), state->file_data.size(), state->reader_settings, state.get());
+
+			// Release everything that refers to user data before reporting that the thread is done, the state itself may outlive Wait() by a bit.
+			state->file_data = std::vector<uint8>{};
+			state->callbacks = Callbacks{};
+			if (state->cancelled) state->scene = Scene{};
+
+			{
+				const std::lock_guard<std::mutex> lock{ state->done_mutex };
+				state->done = true;
+			}
+			state->done_condition.notify_all();
+		} }.detach();
+	}
+
+	AsyncSceneLoad::~AsyncSceneLoad()
+	{
+		Release();
+	}
+
+	AsyncSceneLoad& AsyncSceneLoad::operator=(AsyncSceneLoad&& other) noexcept
+	{
+		if (this != &other)
+		{
+			Release();
+			state = std::move(other.state);
+		}
+
+		return *this;
+	}
+
+	float AsyncSceneLoad::GetProgress() const
+	{
+		return state != nullptr ? state->progress.load() : 0.0f;
+	}
+
+	bool AsyncSceneLoad::IsDone() const
+	{
+		if (state == nullptr) return true;
+
+		const std::lock_guard<std::mutex> lock{ state->done_mutex };
+		return state->done;
+	}
+
+	bool AsyncSceneLoad::IsCancelled() const
+	{
+		return state != nullptr && state->cancelled;
+	}
+
+	void AsyncSceneLoad::Cancel()
+	{
+		if (state == nullptr) return;
+
+		state->cancelled = true;
+	}
+
+	void AsyncSceneLoad::Wait() const
+	{
+		if (state == nullptr) return;
+
+		std::unique_lock<std::mutex> lock{ state->done_mutex };
+		state->done_condition.wait(lock, [this]() { return state->done; });
+	}
+
+	Scene AsyncSceneLoad::Get()
+	{
+		assert(state != nullptr && "AsyncSceneLoad::Get() can only be called once!");
+
+		Wait();
+
+		Scene scene = std::move(state->scene);
+		state.reset();
+		return scene;
+	}
+
+	void AsyncSceneLoad::Release()
+	{
+		if (state == nullptr) return;
+
+		Cancel();
+
+		// A finished scene is freed here rather than by whichever thread drops the state last, so it's released through the memory resource before this returns.
+		if (IsDone()) state->scene = Scene{};
+		state.reset();
+	}
+
+	std::shared_ptr<const Model> ModelCache::Find(const uint64 key) const
+	{
+		const std::lock_guard<std::mutex> lock{ mutex };
+
+		const auto& iterator = models.find(key);
+		if (iterator == models.end()) return nullptr;
+
+		return iterator->second;
+	}
+
+	std::shared_ptr<const Model> ModelCache::Insert(const uint64 key, const Model& model)
+	{
+		const std::lock_guard<std::mutex> lock{ mutex };
+
+		std::shared_ptr<const Model>& cached_model = models[key];
+		if (cached_model == nullptr) cached_model = std::make_shared<const Model>(model);
+
+		return cached_model;
+	}
+
+	void ModelCache::Clear()
+	{
+		const std::lock_guard<std::mutex> lock{ mutex };
+		models.clear();
+	}
+
+	usize ModelCache::GetSize() const
+	{
+		const std::lock_guard<std::mutex> lock{ mutex };
+		return models.size();
+	}
+
+	Occupancy::Occupancy(const Model& model) : size{ model.size }
+	{
+		words_per_row = (size.x + 63) / 64;
+		words.resize(static_cast<usize>(words_per_row) * size.y * size.z, 0);
+
+		brick_count = Model::Size{ (size.x + brick_size - 1) / brick_size, (size.y + brick_size - 1) / brick_size, (size.z + brick_size - 1) / brick_size };
+		bricks.resize(static_cast<usize>(brick_count.x) * brick_count.y * brick_count.z, 0);
+
+		for (uint32 z = 0; z < size.z; z++)
+		{
+			for (uint32 y = 0; y < size.y; y++)
+			{
+				const uint8* voxels = &model.voxel_data[(y + z * size.y) * size.x];
+				uint64* row = &words[(y + z * size.y) * words_per_row];
+
+				uint32 x = 0;
+#ifdef VOXREADER_SSE2
+				// Compare 16 voxels at a time against 0 and gather the results into 16 bits.
+				const __m128i zero = _mm_setzero_si128();
+				for (; x + 16 <= size.x; x += 16)
+				{
+					const __m128i voxel_block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(voxels + x));
+					const uint64 empty_bits = static_cast<uint32>(_mm_movemask_epi8(_mm_cmpeq_epi8(voxel_block, zero)));
+					row[x >> 6] |= (~empty_bits & 0xFFFF) << (x & 63);
+				}
+#endif
+				for (; x < size.x; x++)
+				{
+					row[x >> 6] |= static_cast<uint64>(voxels[x] != 0) << (x & 63);
+				}
+
+				// Mark the bricks that this row passes through (a brick spans 8 bits of a word).
+				uint8* brick_row = &bricks[((y / brick_size) + (z / brick_size) * brick_count.y) * brick_count.x];
+				for (uint32 brick_x = 0; brick_x < brick_count.x; brick_x++)
+				{
+					const uint32 bit = brick_x * brick_size;
+					brick_row[brick_x] |= static_cast<uint8>((row[bit >> 6] >> (bit & 63)) & 0xFF);
+				}
+			}
+		}
+	}
+
+	std::vector<SurfaceVoxel> ExtractSurface(const Occupancy& occupancy)
+	{
+		const Model::Size& size = occupancy.size;
+		assert(size.x <= 256 && size.y <= 256 && size.z <= 256 && "Surface voxel coordinates only support models up to 256 voxels in size!");
+
+		std::vector<SurfaceVoxel> surface;
+
+		// Rows outside of the model are treated as empty.
+		const std::vector<uint64> empty_row(occupancy.words_per_row, 0);
+		const auto row_at = [&](const uint32 y, const uint32 z)
+		{
+			return (y < size.y && z < size.z) ? occupancy.GetRow(y, z) : empty_row.data();
+		};
+
+		for (uint32 z = 0; z < size.z; z++)
+		{
+			for (uint32 y = 0; y < size.y; y++)
+			{
+				const uint64* row = occupancy.GetRow(y, z);
+				const uint64* row_negative_y = row_at(y - 1, z);
+				const uint64* row_positive_y = row_at(y + 1, z);
+				const uint64* row_negative_z = row_at(y, z - 1);
+				const uint64* row_positive_z = row_at(y, z + 1);
+
+				for (uint32 word = 0; word < occupancy.words_per_row; word++)
+				{
+					const uint64 occupied = row[word];
+					if (occupied == 0) continue;
+
+					// Shift the neighboring voxels along the x axis into place, carrying the bits over from the neighboring words.
+					const uint64 previous_word = (word > 0) ? row[word - 1] : 0;
+					const uint64 next_word = (word + 1 < occupancy.words_per_row) ? row[word + 1] : 0;
+					const uint64 neighbors_negative_x = (occupied << 1) | (previous_word >> 63);
+					const uint64 neighbors_positive_x = (occupied >> 1) | (next_word << 63);
+
+					const uint64 exposed[6]
+					{
+						occupied & ~neighbors_negative_x,
+						occupied & ~neighbors_positive_x,
+						occupied & ~row_negative_y[word],
+						occupied & ~row_positive_y[word],
+						occupied & ~row_negative_z[word],
+						occupied & ~row_positive_z[word]
+					};
+
+					uint64 any_exposed = exposed[0] | exposed[1] | exposed[2] | exposed[3] | exposed[4] | exposed[5];
+					while (any_exposed != 0)
+					{
+						const usize bit = CountTrailingZeros(any_exposed);
+						any_exposed &= any_exposed - 1;
+
+						uint8 exposed_faces = 0;
+						for (usize face = 0; face < 6; face++)
+						{
+							exposed_faces |= static_cast<uint8>(((exposed[face] >> bit) & 0b1) << face);
+						}
+
+						surface.push_back(SurfaceVoxel{ static_cast<uint8>(word * 64 + bit), static_cast<uint8>(y), static_cast<uint8>(z), exposed_faces });
+					}
+				}
+			}
+		}
+
+		return surface;
+	}
+
+	std::vector<SurfaceVoxel> ExtractSurface(const Model& model)
+	{
+		return ExtractSurface(Occupancy{ model });
+	}
+
+	namespace
+	{
+		// Normal and tangent axes of each face, the tangents are ordered so that u x v points along the normal.
+		struct FaceAxes
+		{
+			sint32 normal[3];
+			sint32 u[3];
+			sint32 v[3];
+		};
+
+		constexpr FaceAxes face_axes[6]
+		{
+			{ { -1, 0, 0 }, { 0, 0, 1 }, { 0, 1, 0 } },
+			{ { 1, 0, 0 }, { 0, 1, 0 }, { 0, 0, 1 } },
+			{ { 0, -1, 0 }, { 1, 0, 0 }, { 0, 0, 1 } },
+			{ { 0, 1, 0 }, { 0, 0, 1 }, { 1, 0, 0 } },
+			{ { 0, 0, -1 }, { 0, 1, 0 }, { 1, 0, 0 } },
+			{ { 0, 0, 1 }, { 1, 0, 0 }, { 0, 1, 0 } }
+		};
+
+		// Directions of the 4 corners along (u, v) in counter-clockwise order.
+		constexpr sint32 corner_directions[4][2]{ { -1, -1 }, { 1, -1 }, { 1, 1 }, { -1, 1 } };
+	}
+
+	std::vector<FaceVertex> ExtractFaceVertices(const Occupancy& occupancy, const Model& model)
+	{
+		const Model::Size& size = occupancy.size;
+		std::vector<FaceVertex> vertices;
+
+		const std::vector<uint64> empty_row(occupancy.words_per_row, 0);
+		const auto row_at = [&](const uint32 y, const uint32 z)
+		{
+			return (y < size.y && z < size.z) ? occupancy.GetRow(y, z) : empty_row.data();
+		};
+
+		for (uint32 z = 0; z < size.z; z++)
+		{
+			for (uint32 y = 0; y < size.y; y++)
+			{
+				for (uint32 word = 0; word < occupancy.words_per_row; word++)
+				{
+					const uint64 occupied = occupancy.GetRow(y, z)[word];
+					if (occupied == 0) continue;
+
+					// The 3x3x3 neighborhood of all 64 voxels, bit i of neighbors[dz + 1][dy + 1][dx + 1] is the voxel at (word * 64 + i + dx, y + dy, z + dz).
+					uint64 neighbors[3][3][3];
+					for (uint32 dz = 0; dz < 3; dz++)
+					{
+						for (uint32 dy = 0; dy < 3; dy++)
+						{
+							const uint64* row = row_at(y + dy - 1, z + dz - 1);
+							const uint64 previous_word = (word > 0) ? row[word - 1] : 0;
+							const uint64 next_word = (word + 1 < occupancy.words_per_row) ? row[word + 1] : 0;
+
+							neighbors[dz][dy][0] = (row[word] << 1) | (previous_word >> 63);
+							neighbors[dz][dy][1] = row[word];
+							neighbors[dz][dy][2] = (row[word] >> 1) | (next_word << 63);
+						}
+					}
+
+					const auto neighbor = [&](const sint32 (&offset)[3])
+					{
+						return neighbors[offset[2] + 1][offset[1] + 1][offset[0] + 1];
+					};
+
+					for (uint32 face = 0; face < 6; face++)
+					{
+						const FaceAxes& axes = face_axes[face];
+
+						uint64 exposed = occupied & ~neighbor(axes.normal);
+						if (exposed == 0) continue;
+
+						// Occlusion of each corner from its side neighbors a and b and its corner neighbor c: 0 if both sides are occupied, otherwise 3 minus the occupied neighbor count.
+						// As bits: the high bit is set when at most one neighbor is occupied, the low bit when none or c and exactly one side are.
+						uint64 high_bits[4];
+						uint64 low_bits[4];
+						for (uint32 corner = 0; corner < 4; corner++)
+						{
+							const sint32 du = corner_directions[corner][0];
+							const sint32 dv = corner_directions[corner][1];
+
+							sint32 side_u[3];
+							sint32 side_v[3];
+							sint32 diagonal[3];
+							for (uint32 axis = 0; axis < 3; axis++)
+							{
+								side_u[axis] = axes.normal[axis] + du * axes.u[axis];
+								side_v[axis] = axes.normal[axis] + dv * axes.v[axis];
+								diagonal[axis] = side_u[axis] + dv * axes.v[axis];
+							}
+
+							const uint64 a = neighbor(side_u);
+							const uint64 b = neighbor(side_v);
+							const uint64 c = neighbor(diagonal);
+							high_bits[corner] = ~((a & b) | (a & c) | (b & c));
+							low_bits[corner] = ~(a | b | c) | (c & (a ^ b));
+						}
+
+						while (exposed != 0)
+						{
+							const uint32 bit = static_cast<uint32>(CountTrailingZeros(exposed));
+							exposed &= exposed - 1;
+
+							const uint32 x = word * 64 + bit;
+							const uint8 palette_index = model.voxel_data[x + (y * size.x) + (z * size.x * size.y)];
+							const uint32 voxel[3]{ x, y, z };
+
+							for (uint32 corner = 0; corner < 4; corner++)
+							{
+								uint32 position[3];
+								for (uint32 axis = 0; axis < 3; axis++)
+								{
+									// Faces and corners in the positive direction are on the far side of the voxel.
+									const bool far_side = (axes.normal[axis] > 0) || (axes.u[axis] * corner_directions[corner][0] > 0) || (axes.v[axis] * corner_directions[corner][1] > 0);
+									position[axis] = voxel[axis] + (far_side ? 1 : 0);
+								}
+
+								const uint32 occlusion = (((high_bits[corner] >> bit) & 0b1) << 1) | ((low_bits[corner] >> bit) & 0b1);
+								vertices.push_back(FaceVertex
+								{
+									static_cast<uint16>(position[0]), static_cast<uint16>(position[1]), static_cast<uint16>(position[2]),
+									static_cast<uint8>(face | (occlusion << 3)), palette_index
+								});
+							}
+						}
+					}
+				}
+			}
+		}
+
+		return vertices;
+	}
+
+	std::vector<FaceVertex> ExtractFaceVertices(const Model& model)
+	{
+		return ExtractFaceVertices(Occupancy{ model }, model);
+	}
+
+	Raycaster::Raycaster(const Scene& scene, const ReaderSettings& reader_settings) : scene{ &scene }
+	{
+		occupancies.resize(scene.models.size());
+		ParallelFor(scene.models.size(), [&](const usize i)
+		{
+			occupancies[i] = Occupancy{ scene.models[i] };
+		});
+
+		instance_data.reserve(scene.instances.size());
+		for (usize i = 0; i < scene.instances.size(); i++)
+		{
+			const Instance& instance = scene.instances[i];
+			const Transform& transform = scene.transforms[instance.transform_index];
+			const Model::Size& size = scene.models[instance.model_index].size;
+			if (transform.hidden || size.x == 0 || size.y == 0 || size.z == 0) continue;
+
+			// Grid space (voxel units with the origin at the model's corner) to world space.
+			Matrix grid_to_world{};
+			grid_to_world.cells[0][0] = reader_settings.voxel_scale.x;
+			grid_to_world.cells[1][1] = reader_settings.voxel_scale.y;
+			grid_to_world.cells[2][2] = reader_settings.voxel_scale.z;
+			grid_to_world.cells[3][0] = -static_cast<float>(size.x) * 0.5f * reader_settings.voxel_scale.x;
+			grid_to_world.cells[3][1] = -static_cast<float>(size.y) * 0.5f * reader_settings.voxel_scale.y;
+			grid_to_world.cells[3][2] = -static_cast<float>(size.z) * 0.5f * reader_settings.voxel_scale.z;
+			grid_to_world *= transform.matrix;
+
+			InstanceData& data = instance_data.emplace_back();
+			data.world_to_grid = InverseAffine(grid_to_world);
+			data.instance_index = static_cast<uint32>(i);
+			data.model_index = instance.model_index;
+
+			data.bounds_min = Vector{ FLT_MAX, FLT_MAX, FLT_MAX };
+			data.bounds_max = Vector{ -FLT_MAX, -FLT_MAX, -FLT_MAX };
+			for (uint32 corner = 0; corner < 8; corner++)
+			{
+				const Vector grid_corner
+				{
+					corner & 0b001 ? static_cast<float>(size.x) : 0.0f,
+					corner & 0b010 ? static_cast<float>(size.y) : 0.0f,
+					corner & 0b100 ? static_cast<float>(size.z) : 0.0f
+				};
+				const Vector world_corner = TransformPoint(grid_corner, grid_to_world);
+
+				data.bounds_min = Vector{ std::min(data.bounds_min.x, world_corner.x), std::min(data.bounds_min.y, world_corner.y), std::min(data.bounds_min.z, world_corner.z) };
+				data.bounds_max = Vector{ std::max(data.bounds_max.x, world_corner.x), std::max(data.bounds_max.y, world_corner.y), std::max(data.bounds_max.z, world_corner.z) };
+			}
+		}
+	}
+
+	RaycastHit Raycaster::Trace(const Ray& ray) const
+	{
+		RaycastHit hit{};
+		hit.distance = ray.max_distance;
+
+		const float origin[3]{ ray.origin.x, ray.origin.y, ray.origin.z };
+		const float direction[3]{ ray.direction.x, ray.direction.y, ray.direction.z };
+		for (const InstanceData& instance : instance_data)
+		{
+			const float bounds_min[3]{ instance.bounds_min.x, instance.bounds_min.y, instance.bounds_min.z };
+			const float bounds_max[3]{ instance.bounds_max.x, instance.bounds_max.y, instance.bounds_max.z };
+
+			float t_near = 0.0f;
+			float t_far = hit.distance;
+			sint32 entry_axis;
+			if (ClipRayToBox(origin, direction, bounds_min, bounds_max, t_near, t_far, entry_axis))
+			{
+				TraceInstance(ray, instance, hit);
+			}
+		}
+
+		if (!hit.hit) hit.distance = FLT_MAX;
+		return hit;
+	}
+
+	void Raycaster::TraceBatch(const Ray* rays, RaycastHit* hits, const usize ray_count) const
+	{
+		constexpr usize packet_size = 4;
+		const usize packet_count = (ray_count + packet_size - 1) / packet_size;
+
+		ParallelFor(packet_count, [&](const usize packet_index)
+		{
+			const usize first_ray = packet_index * packet_size;
+			const usize packet_ray_count = std::min(packet_size, ray_count - first_ray);
+
+			for (usize i = 0; i < packet_ray_count; i++)
+			{
+				hits[first_ray + i] = RaycastHit{};
+				hits[first_ray + i].distance = rays[first_ray + i].max_distance;
+			}
+
+#ifdef VOXREADER_SSE2
+			// Store the packet's rays as structure of arrays, unused lanes get a ray that misses everything.
+			alignas(16) float origin[3][packet_size]{};
+			alignas(16) float inverse_direction[3][packet_size]{};
+			alignas(16) float direction[3][packet_size]{};
+			for (usize i = 0; i < packet_size; i++)
+			{
+				const bool valid = (i < packet_ray_count);
+				const Ray& ray = rays[first_ray + (valid ? i : 0)];
+
+				origin[0][i] = ray.origin.x;
+				origin[1][i] = ray.origin.y;
+				origin[2][i] = ray.origin.z;
+				inverse_direction[0][i] = valid ? 1.0f / ray.direction.x : 0.0f;
+				inverse_direction[1][i] = valid ? 1.0f / ray.direction.y : 0.0f;
+				inverse_direction[2][i] = valid ? 1.0f / ray.direction.z : 0.0f;
+				direction[0][i] = valid ? ray.direction.x : 1.0f;
+				direction[1][i] = valid ? ray.direction.y : 1.0f;
+				direction[2][i] = valid ? ray.direction.z : 1.0f;
+			}
+
+			const __m128 origin_x = _mm_load_ps(origin[0]);
+			const __m128 origin_y = _mm_load_ps(origin[1]);
+			const __m128 origin_z = _mm_load_ps(origin[2]);
+			const __m128 inverse_direction_x = _mm_load_ps(inverse_direction[0]);
+			const __m128 inverse_direction_y = _mm_load_ps(inverse_direction[1]);
+			const __m128 inverse_direction_z = _mm_load_ps(inverse_direction[2]);
+			const __m128 parallel_x = _mm_cmpeq_ps(_mm_load_ps(direction[0]), _mm_setzero_ps());
+			const __m128 parallel_y = _mm_cmpeq_ps(_mm_load_ps(direction[1]), _mm_setzero_ps());
+			const __m128 parallel_z = _mm_cmpeq_ps(_mm_load_ps(direction[2]), _mm_setzero_ps());
+			const usize valid_mask = (usize{ 1 } << packet_ray_count) - 1;
+
+			for (const InstanceData& instance : instance_data)
+			{
+				// 4-wide slab test of the packet against the instance's world bounds.
+				// Like ClipRayToBox(), lanes with a zero direction component only test whether the origin is inside the slab, since an origin on a bound plane gives 0 * inf = NaN.
+				const auto slab = [](const __m128 origin_axis, const __m128 inverse_direction_axis, const __m128 parallel, const float box_min, const float box_max, __m128& t_near, __m128& t_far)
+				{
+					const __m128 bound_min = _mm_set1_ps(box_min);
+					const __m128 bound_max = _mm_set1_ps(box_max);
+					const __m128 t_0 = _mm_mul_ps(_mm_sub_ps(bound_min, origin_axis), inverse_direction_axis);
+					const __m128 t_1 = _mm_mul_ps(_mm_sub_ps(bound_max, origin_axis), inverse_direction_axis);
+					const __m128 clipped_near = _mm_max_ps(t_near, _mm_min_ps(t_0, t_1));
+					const __m128 clipped_far = _mm_min_ps(t_far, _mm_max_ps(t_0, t_1));
+
+					const __m128 outside = _mm_or_ps(_mm_cmplt_ps(origin_axis, bound_min), _mm_cmpgt_ps(origin_axis, bound_max));
+					const __m128 parallel_far = _mm_or_ps(_mm_andnot_ps(outside, t_far), _mm_and_ps(outside, _mm_set1_ps(-FLT_MAX)));
+					t_near = _mm_or_ps(_mm_andnot_ps(parallel, clipped_near), _mm_and_ps(parallel, t_near));
+					t_far = _mm_or_ps(_mm_andnot_ps(parallel, clipped_far), _mm_and_ps(parallel, parallel_far));
+				};
+
+				alignas(16) float hit_distances[packet_size]{};
+				for (usize i = 0; i < packet_ray_count; i++) hit_distances[i] = hits[first_ray + i].distance;
+
+				__m128 t_near = _mm_setzero_ps();
+				__m128 t_far = _mm_load_ps(hit_distances);
+				slab(origin_x, inverse_direction_x, parallel_x, instance.bounds_min.x, instance.bounds_max.x, t_near, t_far);
+				slab(origin_y, inverse_direction_y, parallel_y, instance.bounds_min.y, instance.bounds_max.y, t_near, t_far);
+				slab(origin_z, inverse_direction_z, parallel_z, instance.bounds_min.z, instance.bounds_max.z, t_near, t_far);
+
+				usize hit_mask = static_cast<usize>(_mm_movemask_ps(_mm_cmple_ps(t_near, t_far))) & valid_mask;
+				while (hit_mask != 0)
+				{
+					const usize i = CountTrailingZeros(hit_mask);
+					hit_mask &= hit_mask - 1;
+
+					TraceInstance(rays[first_ray + i], instance, hits[first_ray + i]);
+				}
+			}
+
+			for (usize i = 0; i < packet_ray_count; i++)
+			{
+				if (!hits[first_ray + i].hit) hits[first_ray + i].distance = FLT_MAX;
+			}
+#else
+			for (usize i = 0; i < packet_ray_count; i++)
+			{
+				hits[first_ray + i] = Trace(rays[first_ray + i]);
+			}
+#endif
+		});
+	}
+
+	void Raycaster::TraceInstance(const Ray& ray, const InstanceData& instance, RaycastHit& hit) const
+	{
+		const Occupancy& occupancy = occupancies[instance.model_index];
+
+		// Transform the ray to the model's grid space, the ray parameter t stays the same in both spaces.
+		const Vector grid_origin = TransformPoint(ray.origin, instance.world_to_grid);
+		Vector grid_direction = ray.direction;
+		grid_direction *= instance.world_to_grid;
+
+		const float origin[3]{ grid_origin.x, grid_origin.y, grid_origin.z };
+		const float direction[3]{ grid_direction.x, grid_direction.y, grid_direction.z };
+		const float grid_min[3]{ 0.0f, 0.0f, 0.0f };
+		const float grid_max[3]{ static_cast<float>(occupancy.size.x), static_cast<float>(occupancy.size.y), static_cast<float>(occupancy.size.z) };
+
+		float t_near = 0.0f;
+		float t_far = hit.distance;
+		sint32 entry_axis;
+		if (!ClipRayToBox(origin, direction, grid_min, grid_max, t_near, t_far, entry_axis)) return;
+
+		const sint32 brick_min[3]{ 0, 0, 0 };
+		const sint32 brick_max[3]{ static_cast<sint32>(occupancy.brick_count.x), static_cast<sint32>(occupancy.brick_count.y), static_cast<sint32>(occupancy.brick_count.z) };
+
+		// Walk the bricks first and only walk the voxels of the bricks that contain any.
+		TraverseGrid(origin, direction, t_near, t_far, static_cast<float>(Occupancy::brick_size), brick_min, brick_max, entry_axis, [&](const sint32 (&brick)[3], const float t_brick_enter, const float t_brick_exit, const sint32 brick_entry_axis)
+		{
+			if (!occupancy.IsBrickOccupied(brick[0], brick[1], brick[2])) return false;
+
+			const sint32 voxel_min[3]{ brick[0] * static_cast<sint32>(Occupancy::brick_size), brick[1] * static_cast<sint32>(Occupancy::brick_size), brick[2] * static_cast<sint32>(Occupancy::brick_size) };
+			const sint32 voxel_max[3]
+			{
+				std::min(voxel_min[0] + static_cast<sint32>(Occupancy::brick_size), static_cast<sint32>(occupancy.size.x)),
+				std::min(voxel_min[1] + static_cast<sint32>(Occupancy::brick_size), static_cast<sint32>(occupancy.size.y)),
+				std::min(voxel_min[2] + static_cast<sint32>(Occupancy::brick_size), static_cast<sint32>(occupancy.size.z))
+			};
+
+			return TraverseGrid(origin, direction, t_brick_enter, t_brick_exit, 1.0f, voxel_min, voxel_max, brick_entry_axis, [&](const sint32 (&voxel)[3], const float t_voxel_enter, float, const sint32 voxel_entry_axis)
+			{
+				if (!occupancy.IsOccupied(voxel[0], voxel[1], voxel[2])) return false;
+
+				hit.hit = true;
+				hit.distance = t_voxel_enter;
+				hit.instance_index = instance.instance_index;
+				hit.model_index = instance.model_index;
+				hit.voxel_x = static_cast<uint32>(voxel[0]);
+				hit.voxel_y = static_cast<uint32>(voxel[1]);
+				hit.voxel_z = static_cast<uint32>(voxel[2]);
+
+				const Model& model = scene->models[instance.model_index];
+				hit.palette_index = model.voxel_data[hit.voxel_x + (hit.voxel_y * model.size.x) + (hit.voxel_z * model.size.x * model.size.y)];
+
+				// Normals transform with the inverse transpose, which is a column of the world to grid matrix (the ray starts inside the voxel if there is no entry axis).
+				hit.normal = Vector{};
+				if (voxel_entry_axis >= 0)
+				{
+					const float sign = direction[voxel_entry_axis] > 0.0f ? -1.0f : 1.0f;
+					Vector normal
+					{
+						instance.world_to_grid.cells[0][voxel_entry_axis] * sign,
+						instance.world_to_grid.cells[1][voxel_entry_axis] * sign,
+						instance.world_to_grid.cells[2][voxel_entry_axis] * sign
+					};
+					const float length = std::sqrt(normal.x * normal.x + normal.y * normal.y + normal.z * normal.z);
+					hit.normal = Vector{ normal.x / length, normal.y / length, normal.z / length };
+				}
+
+				return true;
+			});
+		});
+	}
+
+	namespace
+	{
+		// Reduces 8 voxels to a single voxel using the most frequent non-empty palette index (ties go to the lowest index).
+		uint8 ReduceVoxels(const uint8 (&voxels)[8], const MipChainSettings& settings)
+		{
+			uint32 occupied_count = 0;
+			uint8 result = 0;
+			uint32 result_count = 0;
+			for (usize i = 0; i < 8; i++)
+			{
+				if (voxels[i] == 0) continue;
+				occupied_count++;
+
+				uint32 count = 0;
+				for (usize j = 0; j < 8; j++) count += (voxels[j] == voxels[i]);
+
+				if (count > result_count || (count == result_count && voxels[i] < result))
+				{
+					result = voxels[i];
+					result_count = count;
+				}
+			}
+
+			if (settings.reduction == MipChainSettings::OCCUPANCY_THRESHOLD && occupied_count < settings.occupancy_threshold) return 0;
+			return result;
+		}
+
+		Model DownsampleModel(const Model& model, const MipChainSettings& settings)
+		{
+			const Model::Size& size = model.size;
+			const Model::Size new_size{ (size.x + 1) / 2, (size.y + 1) / 2, (size.z + 1) / 2 };
+			std::pmr::vector<uint8> new_voxel_data(static_cast<usize>(new_size.x) * new_size.y * new_size.z, 0);
+
+			const auto voxel_at = [&](const uint32 x, const uint32 y, const uint32 z) -> uint8
+			{
+				if (x >= size.x || y >= size.y || z >= size.z) return 0;
+				return model.voxel_data[x + (y * size.x) + (z * size.x * size.y)];
+			};
+
+			for (uint32 z = 0; z < new_size.z; z++)
+			{
+				for (uint32 y = 0; y < new_size.y; y++)
+				{
+					uint8* new_row = &new_voxel_data[(y + z * new_size.y) * new_size.x];
+					uint32 x = 0;
+
+#ifdef VOXREADER_SSE2
+					// Fast path for uniform 2x2x2 blocks (the common case), 16 output voxels at a time from 4 source rows of 32 voxels.
+					if (2 * y + 1 < size.y && 2 * z + 1 < size.z)
+					{
+						const uint8* rows[4]
+						{
+							&model.voxel_data[((2 * y) + (2 * z) * size.y) * size.x],
+							&model.voxel_data[((2 * y + 1) + (2 * z) * size.y) * size.x],
+							&model.voxel_data[((2 * y) + (2 * z + 1) * size.y) * size.x],
+							&model.voxel_data[((2 * y + 1) + (2 * z + 1) * size.y) * size.x]
+						};
+
+						const __m128i low_bytes = _mm_set1_epi16(0x00FF);
+						for (; 2 * x + 32 <= size.x; x += 16)
+						{
+							// Split every row in the voxels at even and odd x coordinates.
+							__m128i even[4];
+							__m128i odd[4];
+							for (usize row = 0; row < 4; row++)
+							{
+								const __m128i first = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rows[row] + 2 * x));
+								const __m128i second = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rows[row] + 2 * x + 16));
+								even[row] = _mm_packus_epi16(_mm_and_si128(first, low_bytes), _mm_and_si128(second, low_bytes));
+								odd[row] = _mm_packus_epi16(_mm_srli_epi16(first, 8), _mm_srli_epi16(second, 8));
+							}
+
+							__m128i uniform = _mm_cmpeq_epi8(even[0], odd[0]);
+							for (usize row = 1; row < 4; row++)
+							{
+								uniform = _mm_and_si128(uniform, _mm_cmpeq_epi8(even[0], even[row]));
+								uniform = _mm_and_si128(uniform, _mm_cmpeq_epi8(even[0], odd[row]));
+							}
+
+							_mm_storeu_si128(reinterpret_cast<__m128i*>(new_row + x), even[0]);
+
+							uint32 mixed_mask = ~static_cast<uint32>(_mm_movemask_epi8(uniform)) & 0xFFFF;
+							while (mixed_mask != 0)
+							{
+								const uint32 i = static_cast<uint32>(CountTrailingZeros(mixed_mask));
+								mixed_mask &= mixed_mask - 1;
+
+								const uint32 source_x = 2 * (x + i);
+								const uint8 voxels[8]
+								{
+									rows[0][source_x], rows[0][source_x + 1], rows[1][source_x], rows[1][source_x + 1],
+									rows[2][source_x], rows[2][source_x + 1], rows[3][source_x], rows[3][source_x + 1]
+								};
+								new_row[x + i] = ReduceVoxels(voxels, settings);
+							}
+						}
+					}
+#endif
+
+					for (; x < new_size.x; x++)
+					{
+						const uint8 voxels[8]
+						{
+							voxel_at(2 * x, 2 * y, 2 * z), voxel_at(2 * x + 1, 2 * y, 2 * z), voxel_at(2 * x, 2 * y + 1, 2 * z), voxel_at(2 * x + 1, 2 * y + 1, 2 * z),
+							voxel_at(2 * x, 2 * y, 2 * z + 1), voxel_at(2 * x + 1, 2 * y, 2 * z + 1), voxel_at(2 * x, 2 * y + 1, 2 * z + 1), voxel_at(2 * x + 1, 2 * y + 1, 2 * z + 1)
+						};
+						new_row[x] = ReduceVoxels(voxels, settings);
+					}
+				}
+			}
+
+			return Model{ new_size, std::move(new_voxel_data) };
+		}
+	}
+
+	std::vector<Model> GenerateMipChain(const Model& model, const MipChainSettings& settings)
+	{
+		std::vector<Model> levels;
+
+		const Model* previous_level = &model;
+		while (levels.size() < settings.max_levels)
+		{
+			const Model::Size& size = previous_level->size;
+			if (size.x == 0 || size.y == 0 || size.z == 0 || (size.x == 1 && size.y == 1 && size.z == 1)) break;
+
+			levels.push_back(DownsampleModel(*previous_level, settings));
+			previous_level = &levels.back();
+		}
+
+		return levels;
+	}
+
+	std::vector<std::vector<Model>> GenerateMipChains(const Scene& scene, const MipChainSettings& settings)
+	{
+		std::vector<std::vector<Model>> mip_chains(scene.models.size());
+		ParallelFor(scene.models.size(), [&](const usize i)
+		{
+			mip_chains[i] = GenerateMipChain(scene.models[i], settings);
+		});
+
+		return mip_chains;
+	}
+
+	namespace
+	{
+		// Used instead of infinity for the squared distance of voxels without a feature, so the parabola intersections stay finite.
+		constexpr float no_feature = 1e20f;
+
+		// Felzenszwalb and Huttenlocher's exact 1D squared distance transform of the sampled function f (lower envelope of the parabolas rooted at each sample).
+		// The scratch buffers need room for count vertices and count + 1 boundaries.
+		void DistanceTransform1D(const float* f, float* result, const uint32 count, uint32* vertices, float* boundaries)
+		{
+			uint32 k = 0;
+			vertices[0] = 0;
+			boundaries[0] = -no_feature;
+			boundaries[1] = no_feature;
+
+			for (uint32 q = 1; q < count; q++)
+			{
+				const float fq = f[q] + static_cast<float>(q * q);
+				float s;
+				while (true)
+				{
+					const uint32 v = vertices[k];
+					s = (fq - (f[v] + static_cast<float>(v * v))) / static_cast<float>(2 * q - 2 * v);
+					if (s > boundaries[k] || k == 0) break;
+					k--;
+				}
+
+				k++;
+				vertices[k] = q;
+				boundaries[k] = s;
+				boundaries[k + 1] = no_feature;
+			}
+
+			k = 0;
+			for (uint32 q = 0; q < count; q++)
+			{
+				while (boundaries[k + 1] < static_cast<float>(q)) k++;
+
+				const float offset = static_cast<float>(q) - static_cast<float>(vertices[k]);
+				result[q] = offset * offset + f[vertices[k]];
+			}
+		}
+
+		// Applies the 1D transform to count values that are stride apart, through a contiguous scratch line.
+		void DistanceTransformLine(float* values, const usize stride, const uint32 count, std::vector<float>& line, std::vector<uint32>& vertices, std::vector<float>& boundaries)
+		{
+			float* f = line.data();
+			float* result = f + count;
+			for (uint32 i = 0; i < count; i++) f[i] = values[i * stride];
+
+			DistanceTransform1D(f, result, count, vertices.data(), boundaries.data());
+			for (uint32 i = 0; i < count; i++) values[i * stride] = result[i];
+		}
+	}
+
+	DistanceField::DistanceField(const Model& model, const float max_distance) : size{ model.size }, max_distance{ max_distance }
+	{
+		brick_count = Model::Size{ (size.x + brick_size - 1) / brick_size, (size.y + brick_size - 1) / brick_size, (size.z + brick_size - 1) / brick_size };
+
+		// Padding voxels of partially filled bricks are marked as far outside.
+		constexpr usize brick_volume = brick_size * brick_size * brick_size;
+		data.resize(static_cast<usize>(brick_count.x) * brick_count.y * brick_count.z * brick_volume, 255);
+
+		const usize stride_z = static_cast<usize>(size.x) * size.y;
+		const usize voxel_count = stride_z * size.z;
+		if (voxel_count == 0) return;
+
+		// Squared distances to the closest non-empty voxel (for empty voxels) and to the closest empty voxel (for non-empty voxels).
+		std::vector<float> outside_distances(voxel_count);
+		std::vector<float> inside_distances(voxel_count);
+		for (usize i = 0; i < voxel_count; i++)
+		{
+			const bool occupied = model.voxel_data[i] != 0;
+			outside_distances[i] = occupied ? 0.0f : no_feature;
+			inside_distances[i] = occupied ? no_feature : 0.0f;
+		}
+
+		const uint32 max_axis_size = std::max({ size.x, size.y, size.z });
+
+		// The transform is separable, the x and y passes only touch a single z slice and the z pass only a single y slice, so the slices are processed in parallel.
+		ParallelFor(size.z, [&](const usize z)
+		{
+			std::vector<float> line(2 * static_cast<usize>(max_axis_size));
+			std::vector<uint32> vertices(max_axis_size);
+			std::vector<float> boundaries(max_axis_size + 1);
+
+			for (float* distances : { outside_distances.data(), inside_distances.data() })
+			{
+				float* slice = distances + z * stride_z;
+				for (uint32 y = 0; y < size.y; y++) DistanceTransformLine(slice + y * size.x, 1, size.x, line, vertices, boundaries);
+				for (uint32 x = 0; x < size.x; x++) DistanceTransformLine(slice + x, size.x, size.y, line, vertices, boundaries);
+			}
+		});
+
+		ParallelFor(size.y, [&](const usize y)
+		{
+			std::vector<float> line(2 * static_cast<usize>(max_axis_size));
+			std::vector<uint32> vertices(max_axis_size);
+			std::vector<float> boundaries(max_axis_size + 1);
+
+			for (float* distances : { outside_distances.data(), inside_distances.data() })
+			{
+				float* slice = distances + y * size.x;
+				for (uint32 x = 0; x < size.x; x++) DistanceTransformLine(slice + x, stride_z, size.z, line, vertices, boundaries);
+			}
+		});
+
+		const float quantize_scale = 127.0f / max_distance;
+		ParallelFor(size.z, [&](const usize z)
+		{
+			for (uint32 y = 0; y < size.y; y++)
+			{
+				for (uint32 x = 0; x < size.x; x++)
+				{
+					const usize index = x + y * size.x + z * stride_z;
+
+					float distance;
+					if (model.voxel_data[index] != 0)
+					{
+						// The empty space around the model is never further away than the closest side of the model.
+						const uint32 border_distance = std::min({ x + 1, size.x - x, y + 1, size.y - y, static_cast<uint32>(z) + 1, size.z - static_cast<uint32>(z) });
+						distance = 0.5f - std::sqrt(std::min(inside_distances[index], static_cast<float>(border_distance * border_distance)));
+					}
+					else
+					{
+						distance = std::sqrt(outside_distances[index]) - 0.5f;
+					}
+
+					const float quantized = std::clamp(std::round(distance * quantize_scale) + 128.0f, 1.0f, 255.0f);
+
+					const usize brick = (x / brick_size) + ((y / brick_size) * brick_count.x) + ((z / brick_size) * brick_count.x * brick_count.y);
+					data[brick * brick_volume + (x % brick_size) + ((y % brick_size) * brick_size) + ((z % brick_size) * brick_size * brick_size)] = static_cast<uint8>(quantized);
+				}
+			}
+		});
+	}
+
+	std::vector<VoxelBox> DecomposeBoxes(const Model& model)
+	{
+		std::vector<VoxelBox> boxes;
+
+		// Bits of the voxels that aren't covered by a box yet, every box is grown over these bits and then cleared from them.
+		Occupancy uncovered{ model };
+		const Model::Size& size = uncovered.size;
+		const auto row_at = [&](const uint32 y, const uint32 z)
+		{
+			return &uncovered.words[(y + z * size.y) * uncovered.words_per_row];
+		};
+
+		std::vector<uint64> run_mask(uncovered.words_per_row);
+		uint32 first_word = 0;
+		uint32 last_word = 0;
+
+		// Checks if all voxels of the current run are uncovered in a row.
+		const auto covers_run = [&](const uint64* row)
+		{
+			for (uint32 word = first_word; word <= last_word; word++)
+			{
+				if ((row[word] & run_mask[word]) != run_mask[word]) return false;
+			}
+
+			return true;
+		};
+
+		for (uint32 z = 0; z < size.z; z++)
+		{
+			for (uint32 y = 0; y < size.y; y++)
+			{
+				uint64* row = row_at(y, z);
+				for (uint32 word = 0; word < uncovered.words_per_row; word++)
+				{
+					while (row[word] != 0)
+					{
+						// Grow along x over the run of uncovered voxels, up to 64 voxels at a time.
+						const uint32 min_x = word * 64 + static_cast<uint32>(CountTrailingZeros(row[word]));
+						uint32 max_x = min_x;
+						while (max_x < size.x)
+						{
+							const uint32 bit = max_x & 63;
+							const uint64 empty_bits = ~(row[max_x >> 6] >> bit);
+							const uint32 run = (empty_bits == 0) ? 64 : static_cast<uint32>(CountTrailingZeros(empty_bits));
+
+							max_x += run;
+							if (bit + run < 64) break;
+						}
+
+						first_word = min_x >> 6;
+						last_word = (max_x - 1) >> 6;
+						for (uint32 mask_word = first_word; mask_word <= last_word; mask_word++)
+						{
+							const uint32 low_bit = (mask_word == first_word) ? (min_x & 63) : 0;
+							const uint32 high_bit = (mask_word == last_word) ? ((max_x - 1) & 63) : 63;
+							run_mask[mask_word] = (~0ull >> (63 - high_bit)) & (~0ull << low_bit);
+						}
+
+						// Grow along y while the next row contains the whole run, then along z while the next slice contains all rows.
+						uint32 max_y = y + 1;
+						while (max_y < size.y && covers_run(row_at(max_y, z))) max_y++;
+
+						uint32 max_z = z + 1;
+						while (max_z < size.z)
+						{
+							bool covered = true;
+							for (uint32 box_y = y; box_y < max_y && covered; box_y++) covered = covers_run(row_at(box_y, max_z));
+
+							if (!covered) break;
+							max_z++;
+						}
+
+						for (uint32 box_z = z; box_z < max_z; box_z++)
+						{
+							for (uint32 box_y = y; box_y < max_y; box_y++)
+							{
+								uint64* box_row = row_at(box_y, box_z);
+								for (uint32 mask_word = first_word; mask_word <= last_word; mask_word++) box_row[mask_word] &= ~run_mask[mask_word];
+							}
+						}
+
+						boxes.push_back(VoxelBox
+						{
+							static_cast<uint16>(min_x), static_cast<uint16>(y), static_cast<uint16>(z),
+							static_cast<uint16>(max_x), static_cast<uint16>(max_y), static_cast<uint16>(max_z)
+						});
+					}
+				}
+			}
+		}
+
+		return boxes;
+	}
+
+	SceneBoxes DecomposeBoxes(const Scene& scene)
+	{
+		// Only the first model with a given content hash is decomposed, the others share its boxes (skipped models are empty, so they can't share).
+		const bool has_hashes = (scene.model_hashes.size() == scene.models.size());
+		std::vector<uint32> unique_model_indices(scene.models.size());
+		std::vector<uint32> decomposed_models;
+
+		std::unordered_map<uint64, uint32> first_models;
+		for (uint32 i = 0; i < scene.models.size(); i++)
+		{
+			const bool can_share = has_hashes && !scene.models[i].voxel_data.empty();
+			unique_model_indices[i] = can_share ? first_models.try_emplace(scene.model_hashes[i], i).first->second : i;
+			if (unique_model_indices[i] == i) decomposed_models.push_back(i);
+		}
+
+		std::vector<std::vector<VoxelBox>> model_boxes(decomposed_models.size());
+		ParallelFor(decomposed_models.size(), [&](const usize i)
+		{
+			model_boxes[i] = DecomposeBoxes(scene.models[decomposed_models[i]]);
+		});
+
+		SceneBoxes scene_boxes;
+		scene_boxes.model_ranges.resize(scene.models.size());
+
+		usize box_count = 0;
+		for (const std::vector<VoxelBox>& boxes : model_boxes) box_count += boxes.size();
+		scene_boxes.boxes.reserve(box_count);
+
+		for (usize i = 0; i < decomposed_models.size(); i++)
+		{
+			scene_boxes.model_ranges[decomposed_models[i]] = SceneBoxes::Range{ static_cast<uint32>(scene_boxes.boxes.size()), static_cast<uint32>(model_boxes[i].size()) };
+			scene_boxes.boxes.insert(scene_boxes.boxes.end(), model_boxes[i].begin(), model_boxes[i].end());
+		}
+
+		for (uint32 i = 0; i < scene.models.size(); i++)
+		{
+			scene_boxes.model_ranges[i] = scene_boxes.model_ranges[unique_model_indices[i]];
+		}
+
+		return scene_boxes;
+	}
+
+	namespace
+	{
+		uint32 ColorDistance(const uint32 a, const uint32 b)
+		{
+			uint32 distance = 0;
+			for (uint32 shift = 0; shift < 32; shift += 8)
+			{
+				const sint32 difference = static_cast<sint32>((a >> shift) & 0xFF) - static_cast<sint32>((b >> shift) & 0xFF);
+				distance += static_cast<uint32>(difference * difference);
+			}
+			return distance;
+		}
+
+		// Replaces every voxel by its entry in the 256 entry table, the table must map 0 to 0 since blocks of empty voxels are skipped.
+		void RemapVoxels(uint8* voxels, const usize voxel_count, const uint8* table)
+		{
+			usize i = 0;
+#ifdef VOXREADER_SSSE3
+			// Each shuffle looks up 16 voxels in one 16 entry section of the table, the index is biased so only the voxels inside of that section have their top bit clear (the others shuffle in 0).
+			__m128i sections[16];
+			for (uint32 k = 0; k < 16; k++)
+			{
+				sections[k] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(table + k * 16));
+			}
+
+			const __m128i zero = _mm_setzero_si128();
+			const __m128i section_size = _mm_set1_epi8(16);
+			const __m128i section_bias = _mm_set1_epi8(0x70);
+			for (; i + 16 <= voxel_count; i += 16)
+			{
+				const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(voxels + i));
+				if (_mm_movemask_epi8(_mm_cmpeq_epi8(block, zero)) == 0xFFFF) continue;
+
+				__m128i result = zero;
+				__m128i section_index = block;
+				for (uint32 k = 0; k < 16; k++)
+				{
+					result = _mm_or_si128(result, _mm_shuffle_epi8(sections[k], _mm_adds_epu8(section_index, section_bias)));
+					section_index = _mm_sub_epi8(section_index, section_size);
+				}
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(voxels + i), result);
+			}
+#endif
+			for (; i < voxel_count; i++)
+			{
+				voxels[i] = table[voxels[i]];
+			}
+		}
+	}
+
+	SharedPalette UnifyPalettes(const std::vector<Scene*>& scenes)
+	{
+		std::vector<std::pair<uint32, uint32>> scene_models; // Pairs of (scene index, model index).
+		for (uint32 i = 0; i < scenes.size(); i++)
+		{
+			for (uint32 j = 0; j < scenes[i]->models.size(); j++)
+			{
+				if (!scenes[i]->models[j].voxel_data.empty()) scene_models.emplace_back(i, j);
+			}
+		}
+
+		// Find the palette indices each model uses, so unused colors don't take up room in the shared palette.
+		std::vector<std::array<bool, 256>> model_used_indices(scene_models.size());
+		ParallelFor(scene_models.size(), [&](const usize i)
+		{
+			std::array<bool, 256>& used = model_used_indices[i];
+			used.fill(false);
+			for (const uint8 palette_index : scenes[scene_models[i].first]->models[scene_models[i].second].voxel_data)
+			{
+				used[palette_index] = true;
+			}
+		});
+
+		std::vector<std::array<bool, 256>> used_indices(scenes.size());
+		for (std::array<bool, 256>& used : used_indices) used.fill(false);
+		for (usize i = 0; i < scene_models.size(); i++)
+		{
+			std::array<bool, 256>& used = used_indices[scene_models[i].first];
+			for (uint32 j = 0; j < 256; j++) used[j] |= model_used_indices[i][j];
+		}
+
+		SharedPalette shared;
+		std::vector<uint8> tables(scenes.size() * 256, 0); // One lookup table per scene, unused indices map to 0.
+		for (uint32 i = 0; i < scenes.size(); i++)
+		{
+			const Scene& scene = *scenes[i];
+			uint8* table = tables.data() + i * 256;
+
+			// Colors are added in the order of the IMAP chunk followed by plain order, so used colors that the IMAP chunk doesn't list (if it isn't a full permutation) still get mapped.
+			const uint32 position_count = scene.has_index_map ? 512 : 256;
+			for (uint32 position = 0; position < position_count; position++)
+			{
+				const uint8 palette_index = (position < 256 && scene.has_index_map) ? scene.index_map[position] : static_cast<uint8>(position);
+				if (palette_index == 0 || !used_indices[i][palette_index] || table[palette_index] != 0) continue;
+
+				const uint32 color = scene.palette[palette_index];
+				const Material& material = scene.materials[palette_index];
+
+				uint32 shared_index = 0;
+				for (uint32 j = 1; j < shared.color_count && shared_index == 0; j++)
+				{
+					if (shared.palette[j] == color && MaterialsEqual(shared.materials[j], material)) shared_index = j;
+				}
+
+				if (shared_index == 0 && shared.color_count < 256)
+				{
+					shared_index = shared.color_count++;
+					shared.palette[shared_index] = color;
+					shared.materials[shared_index] = material;
+				}
+				else if (shared_index == 0)
+				{
+					// The shared palette is full, use the closest color (preferring the same material type).
+					uint32 best_distance = UINT32_MAX;
+					bool best_same_type = false;
+					for (uint32 j = 1; j < 256; j++)
+					{
+						const bool same_type = (shared.materials[j].type == material.type);
+						const uint32 distance = ColorDistance(shared.palette[j], color);
+						if ((same_type && !best_same_type) || (same_type == best_same_type && distance < best_distance))
+						{
+							shared_index = j;
+							best_distance = distance;
+							best_same_type = same_type;
+						}
+					}
+				}
+
+				table[palette_index] = static_cast<uint8>(shared_index);
+			}
+		}
+
+		ParallelFor(scene_models.size(), [&](const usize i)
+		{
+			std::pmr::vector<uint8>& voxel_data = scenes[scene_models[i].first]->models[scene_models[i].second].voxel_data;
+			RemapVoxels(voxel_data.data(), voxel_data.size(), tables.data() + scene_models[i].first * 256);
+		});
+
+		// Equal models of a scene are remapped with the same table, so deriving their new hashes from the table keeps equal hashes meaning equal models.
+		for (uint32 i = 0; i < scenes.size(); i++)
+		{
+			Scene& scene = *scenes[i];
+			if (scene.model_hashes.size() != scene.models.size()) continue;
+
+			const uint64 table_hash = HashBytes(tables.data() + i * 256, 256);
+			for (uint64& model_hash : scene.model_hashes) model_hash = MixHash(model_hash ^ table_hash);
+		}
+
+		for (Scene* scene : scenes)
+		{
+			std::memcpy(scene->palette, shared.palette, sizeof(shared.palette));
+			std::copy(std::begin(shared.materials), std::end(shared.materials), std::begin(scene->materials));
+			scene->has_index_map = false;
+		}
+
+		return shared;
+	}
+
+	namespace
+	{
+		void WriteBigEndian(std::vector<uint8>& buffer, const uint32 value)
+		{
+			buffer.insert(buffer.end(), { static_cast<uint8>(value >> 24), static_cast<uint8>(value >> 16), static_cast<uint8>(value >> 8), static_cast<uint8>(value) });
+		}
+
+		uint32 Crc32(const uint8* data, const usize size)
+		{
+			uint32 crc = 0xFFFFFFFF;
+			for (usize i = 0; i < size; i++)
+			{
+				crc ^= data[i];
+				for (uint32 bit = 0; bit < 8; bit++) crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 0b1)));
+			}
+			return ~crc;
+		}
+
+		// Encodes the palette as a 256x1 RGBA PNG image, stored without compression since it's only 1 KB.
+		std::vector<uint8> EncodePalettePng(const uint32 (&palette)[256])
+		{
+			// A single row of pixels, preceded by its filter type (none).
+			std::vector<uint8> pixels(1 + sizeof(palette), 0);
+			std::memcpy(pixels.data() + 1, palette, sizeof(palette));
+
+			// zlib stream with a single stored deflate block, followed by the Adler-32 checksum of the pixels.
+			std::vector<uint8> image_data{ 0x78, 0x01, 0b1 };
+			WriteData(image_data, static_cast<uint16>(pixels.size()));
+			WriteData(image_data, static_cast<uint16>(~pixels.size()));
+			image_data.insert(image_data.end(), pixels.begin(), pixels.end());
+
+			uint32 sum_a = 1;
+			uint32 sum_b = 0;
+			for (const uint8 byte : pixels)
+			{
+				sum_a = (sum_a + byte) % 65521;
+				sum_b = (sum_b + sum_a) % 65521;
+			}
+			WriteBigEndian(image_data, (sum_b << 16) | sum_a);
+
+			std::vector<uint8> png{ 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+			const auto write_chunk = [&png](const std::string_view& type, const std::vector<uint8>& content)
+			{
+				WriteBigEndian(png, static_cast<uint32>(content.size()));
+				const usize type_offset = png.size();
+				png.insert(png.end(), type.begin(), type.end());
+				png.insert(png.end(), content.begin(), content.end());
+				WriteBigEndian(png, Crc32(png.data() + type_offset, png.size() - type_offset));
+			};
+
+			std::vector<uint8> header;
+			WriteBigEndian(header, 256);
+			WriteBigEndian(header, 1);
+			header.insert(header.end(), { 8, 6, 0, 0, 0 }); // 8 bits per channel RGBA, default compression and filtering, not interlaced.
+
+			write_chunk("IHDR", header);
+			write_chunk("IDAT", image_data);
+			write_chunk("IEND", {});
+			return png;
+		}
+
+		void AppendJsonString(std::string& json, const std::string_view& string)
+		{
+			json += '"';
+			for (const char character : string)
+			{
+				if (character == '"' || character == '\\')
+				{
+					json += '\\';
+					json += character;
+				}
+				else if (static_cast<uint8>(character) < 0x20)
+				{
+					constexpr char hex_digits[]{ "0123456789ABCDEF" };
+					json += "\\u00";
+					json += hex_digits[static_cast<uint8>(character) >> 4];
+					json += hex_digits[character & 0xF];
+				}
+				else
+				{
+					json += character;
+				}
+			}
+			json += '"';
+		}
+
+		// Appends an element to a JSON array that is being built, the brackets are added once the array is complete.
+		std::string& NextElement(std::string& array)
+		{
+			if (!array.empty()) array += ',';
+			return array;
+		}
+
+		struct GlbVertex
+		{
+			float position[3];
+			float normal[3];
+			float texcoord[2];
+			uint8 color[4];
+		};
+		static_assert(sizeof(GlbVertex) == 36, "Vertices are written as one interleaved buffer view!");
+
+		struct GlbMesh
+		{
+			uint32 model_index;
+			std::vector<FaceVertex> vertices;
+			// Offsets of the vertices and indices in the binary chunk.
+			usize vertex_offset{ 0 };
+			usize index_offset{ 0 };
+		};
+
+		// Transform of a mesh in the exported scene.
+		struct GlbPlacement
+		{
+			uint32 mesh_index;
+			const Matrix* matrix;
+			const std::pmr::string* name;
+		};
+	}
+
+	void ExportGlb(const Scene& scene, std::ostream& stream, const ReaderSettings& reader_settings, const GlbExportSettings& export_settings)
+	{
+		ExportGlb(scene, [&stream](const void* data, const usize byte_count)
+		{
+			stream.write(static_cast<const char*>(data), static_cast<std::streamsize>(byte_count));
+		}, reader_settings, export_settings);
+	}
+
+	void ExportGlb(const Scene& scene, const Scene::WriteCallback& write, const ReaderSettings& reader_settings, const GlbExportSettings& export_settings)
+	{
+		// One mesh per unique model content (see Scene::model_hashes), shared by all instances of models with that content.
+		const bool has_hashes = (scene.model_hashes.size() == scene.models.size());
+		std::vector<GlbMesh> meshes;
+		std::vector<uint32> model_meshes(scene.models.size(), UINT32_MAX);
+		std::unordered_map<uint64, uint32> meshes_by_hash;
+
+		const auto add_mesh = [&](const uint32 model_index)
+		{
+			if (model_meshes[model_index] != UINT32_MAX) return model_meshes[model_index];
+
+			uint32 mesh_index = static_cast<uint32>(meshes.size());
+			if (has_hashes) mesh_index = meshes_by_hash.try_emplace(scene.model_hashes[model_index], mesh_index).first->second;
+			if (mesh_index == meshes.size()) meshes.emplace_back().model_index = model_index;
+
+			return model_meshes[model_index] = mesh_index;
+		};
+
+		// Without a scene graph (old files), every model is placed at the origin once.
+		static const Matrix identity{};
+		std::vector<GlbPlacement> placements;
+		if (scene.instances.empty())
+		{
+			for (uint32 i = 0; i < scene.models.size(); i++)
+			{
+				if (!scene.models[i].voxel_data.empty()) placements.push_back(GlbPlacement{ add_mesh(i), &identity, nullptr });
+			}
+		}
+		for (const Instance& instance : scene.instances)
+		{
+			const Transform& transform = scene.transforms[instance.transform_index];
+			if ((transform.hidden && !export_settings.include_hidden) || scene.models[instance.model_index].voxel_data.empty()) continue;
+
+			placements.push_back(GlbPlacement{ add_mesh(instance.model_index), &transform.matrix, &transform.name });
+		}
+
+		ParallelFor(meshes.size(), [&](const usize i)
+		{
+			meshes[i].vertices = ExtractFaceVertices(scene.models[meshes[i].model_index]);
+		});
+
+		// Models without exposed faces (all voxels erased) would get empty accessors and buffer views, which glTF doesn't allow, so drop their meshes and placements.
+		std::vector<uint32> mesh_remap(meshes.size(), UINT32_MAX);
+		uint32 kept_mesh_count = 0;
+		for (uint32 i = 0; i < meshes.size(); i++)
+		{
+			if (meshes[i].vertices.empty()) continue;
+
+			mesh_remap[i] = kept_mesh_count;
+			if (i != kept_mesh_count) meshes[kept_mesh_count] = std::move(meshes[i]);
+			kept_mesh_count++;
+		}
+		meshes.resize(kept_mesh_count);
+
+		usize kept_placement_count = 0;
+		for (GlbPlacement& placement : placements)
+		{
+			if (mesh_remap[placement.mesh_index] == UINT32_MAX) continue;
+
+			placement.mesh_index = mesh_remap[placement.mesh_index];
+			placements[kept_placement_count++] = placement;
 		}
-		else
+		placements.resize(kept_placement_count);
+
+		// Lay out the binary chunk: the palette image, the vertices and indices of every mesh, followed by the instance attributes when using EXT_mesh_gpu_instancing.
+		const std::vector<uint8> palette_png = EncodePalettePng(scene.palette);
+		const auto align = [](const usize offset) { return (offset + 3) & ~usize{ 3 }; };
+
+		std::string buffer_views;
+		std::string accessors;
+		usize buffer_view_count = 0;
+		const auto add_buffer_view = [&](const usize offset, const usize size, const char* extra)
+		{
+			NextElement(buffer_views) += "{\"buffer\":0,\"byteOffset\":" + std::to_string(offset) + ",\"byteLength\":" + std::to_string(size) + extra + "}";
+			return buffer_view_count++;
+		};
+		usize accessor_count = 0;
+		const auto add_accessor = [&](const usize buffer_view, const usize offset, const uint32 component_type, const usize count, const char* type, const std::string& extra)
+		{
+			NextElement(accessors) += "{\"bufferView\":" + std::to_string(buffer_view) + ",\"byteOffset\":" + std::to_string(offset) + ",\"componentType\":" + std::to_string(component_type) +
+				",\"count\":" + std::to_string(count) + ",\"type\":\"" + type + "\"" + extra + "}";
+			return accessor_count++;
+		};
+
+		usize bin_size = 0;
+		const usize image_view = add_buffer_view(bin_size, palette_png.size(), "");
+		bin_size = align(palette_png.size());
+
+		std::string mesh_json;
+		for (GlbMesh& mesh : meshes)
 		{
-			SkipData(data, sizeof(uint32)); // Skip shape node id.
-			ReadDict(data); // Shape node attributes, we can ignore these.
+			const Model::Size& size = scene.models[mesh.model_index].size;
+			const usize vertex_count = mesh.vertices.size();
+			const usize index_count = vertex_count / 4 * 6;
 
-			const uint32 model_count = ReadData<uint32>(data);
-			assert(model_count != 0 && "Invalid voxel file, voxel model count is 0!");
+			mesh.vertex_offset = bin_size;
+			mesh.index_offset = bin_size + vertex_count * sizeof(GlbVertex);
+			bin_size = mesh.index_offset + index_count * sizeof(uint32);
 
-			uint32 instance_model_index = 0;
-			for (usize i = 0; i < model_count; i++)
+			// Models are centered on their transform and scaled by the voxel scale, like the Raycaster does.
+			const float scale[3]{ reader_settings.voxel_scale.x, reader_settings.voxel_scale.y, reader_settings.voxel_scale.z };
+			const float extent[3]{ static_cast<float>(size.x), static_cast<float>(size.y), static_cast<float>(size.z) };
+			std::string bounds_min;
+			std::string bounds_max;
+			for (uint32 axis = 0; axis < 3; axis++)
 			{
-				const uint32 model_index = ReadData<uint32>(data);
+				uint16 corner_min = UINT16_MAX;
+				uint16 corner_max = 0;
+				for (const FaceVertex& vertex : mesh.vertices)
+				{
+					const uint16 corner = (axis == 0) ? vertex.x : (axis == 1) ? vertex.y : vertex.z;
+					corner_min = std::min(corner_min, corner);
+					corner_max = std::max(corner_max, corner);
+				}
+				const float low = (static_cast<float>(corner_min) - extent[axis] * 0.5f) * scale[axis];
+				const float high = (static_cast<float>(corner_max) - extent[axis] * 0.5f) * scale[axis];
+				NextElement(bounds_min) += FloatToString(std::min(low, high));
+				NextElement(bounds_max) += FloatToString(std::max(low, high));
+			}
+
+			const usize vertex_view = add_buffer_view(mesh.vertex_offset, vertex_count * sizeof(GlbVertex), ",\"byteStride\":36,\"target\":34962");
+			const usize index_view = add_buffer_view(mesh.index_offset, index_count * sizeof(uint32), ",\"target\":34963");
+
+			std::string attributes = "\"POSITION\":" + std::to_string(add_accessor(vertex_view, offsetof(GlbVertex, position), 5126, vertex_count, "VEC3", ",\"min\":[" + bounds_min + "],\"max\":[" + bounds_max + "]"));
+			attributes += ",\"NORMAL\":" + std::to_string(add_accessor(vertex_view, offsetof(GlbVertex, normal), 5126, vertex_count, "VEC3", ""));
+			attributes += ",\"TEXCOORD_0\":" + std::to_string(add_accessor(vertex_view, offsetof(GlbVertex, texcoord), 5126, vertex_count, "VEC2", ""));
+			if (export_settings.ambient_occlusion) attributes += ",\"COLOR_0\":" + std::to_string(add_accessor(vertex_view, offsetof(GlbVertex, color), 5121, vertex_count, "VEC4", ",\"normalized\":true"));
+			const usize indices = add_accessor(index_view, 0, 5125, index_count, "SCALAR", "");
+
+			NextElement(mesh_json) += "{\"primitives\":[{\"attributes\":{" + attributes + "},\"indices\":" + std::to_string(indices) + ",\"material\":0}]}";
+		}
+
+		// Instance attributes of EXT_mesh_gpu_instancing, per mesh: translations, rotations and scales of all of its placements.
+		std::vector<std::vector<uint32>> mesh_placements(export_settings.gpu_instancing ? meshes.size() : 0);
+		for (uint32 i = 0; i < placements.size() && export_settings.gpu_instancing; i++)
+		{
+			mesh_placements[placements[i].mesh_index].push_back(i);
+		}
+
+		std::string node_json;
+		usize node_count = 0;
+		std::vector<usize> instance_offsets(mesh_placements.size());
+		for (uint32 i = 0; i < mesh_placements.size(); i++)
+		{
+			const usize count = mesh_placements[i].size();
+			if (count == 0) continue;
+
+			instance_offsets[i] = bin_size;
+			const usize instance_view = add_buffer_view(bin_size, count * 10 * sizeof(float), "");
+			bin_size += count * 10 * sizeof(float);
+
+			const usize translation = add_accessor(instance_view, 0, 5126, count, "VEC3", "");
+			const usize rotation = add_accessor(instance_view, count * 3 * sizeof(float), 5126, count, "VEC4", "");
+			const usize scale = add_accessor(instance_view, count * 7 * sizeof(float), 5126, count, "VEC3", "");
+			NextElement(node_json) += "{\"mesh\":" + std::to_string(i) + ",\"extensions\":{\"EXT_mesh_gpu_instancing\":{\"attributes\":{\"TRANSLATION\":" + std::to_string(translation) +
+				",\"ROTATION\":" + std::to_string(rotation) + ",\"SCALE\":" + std::to_string(scale) + "}}}}";
+			node_count++;
+		}
+
+		if (!export_settings.gpu_instancing)
+		{
+			for (const GlbPlacement& placement : placements)
+			{
+				std::string& node = NextElement(node_json) += "{\"mesh\":" + std::to_string(placement.mesh_index);
+				if (placement.name != nullptr && !placement.name->empty())
+				{
+					node += ",\"name\":";
+					AppendJsonString(node, *placement.name);
+				}
+
+				// Matrices use row vectors, so the rows are the columns of glTF's column major matrices.
+				std::string matrix;
+				for (const float value : placement.matrix->data) NextElement(matrix) += FloatToString(value);
+				node += ",\"matrix\":[" + matrix + "]}";
+				node_count++;
+			}
+		}
+
+		std::string node_indices;
+		for (usize i = 0; i < node_count; i++) NextElement(node_indices) += std::to_string(i);
+
+		std::string json = "{\"asset\":{\"version\":\"2.0\",\"generator\":\"VoxReader\"}";
+		if (export_settings.gpu_instancing) json += ",\"extensionsUsed\":[\"EXT_mesh_gpu_instancing\"]";
+		json += ",\"scene\":0,\"scenes\":[{\"nodes\":[" + node_indices + "]}],\"nodes\":[" + node_json + "]";
+		if (!meshes.empty()) json += ",\"meshes\":[" + mesh_json + "]";
+		json += ",\"materials\":[{\"pbrMetallicRoughness\":{\"baseColorTexture\":{\"index\":0},\"metallicFactor\":0,\"roughnessFactor\":1}}]";
+		json += ",\"samplers\":[{\"magFilter\":9728,\"minFilter\":9728,\"wrapS\":33071,\"wrapT\":33071}],\"textures\":[{\"sampler\":0,\"source\":0}]";
+		json += ",\"images\":[{\"bufferView\":" + std::to_string(image_view) + ",\"mimeType\":\"image/png\"}]";
+		json += ",\"accessors\":[" + accessors + "],\"bufferViews\":[" + buffer_views + "],\"buffers\":[{\"byteLength\":" + std::to_string(bin_size) + "}]}";
+		json.resize(align(json.size()), ' ');
+
+		// Assemble the file in a single presized buffer: header, JSON chunk and binary chunk.
+		const usize bin_start = 12 + 8 + json.size() + 8;
+		std::vector<uint8> file_data;
+		file_data.reserve(bin_start + bin_size);
+		file_data.insert(file_data.end(), { 'g', 'l', 'T', 'F' });
+		WriteData<uint32>(file_data, 2);
+		WriteData(file_data, static_cast<uint32>(bin_start + bin_size));
+		WriteData(file_data, static_cast<uint32>(json.size()));
+		file_data.insert(file_data.end(), { 'J', 'S', 'O', 'N' });
+		file_data.insert(file_data.end(), json.begin(), json.end());
+		WriteData(file_data, static_cast<uint32>(bin_size));
+		file_data.insert(file_data.end(), { 'B', 'I', 'N', '\0' });
+		file_data.resize(bin_start + bin_size, 0);
+
+		uint8* const bin = file_data.data() + bin_start;
+		std::memcpy(bin, palette_png.data(), palette_png.size());
+
+		ParallelFor(meshes.size(), [&](const usize i)
+		{
+			const GlbMesh& mesh = meshes[i];
+			const Model::Size& size = scene.models[mesh.model_index].size;
+			const Vector& scale = reader_settings.voxel_scale;
+
+			uint8* vertex_data = bin + mesh.vertex_offset;
+			for (const FaceVertex& face_vertex : mesh.vertices)
+			{
+				const sint32 (&normal)[3] = face_axes[face_vertex.GetFace()].normal;
+				const uint8 brightness = static_cast<uint8>(255 - (3 - face_vertex.GetOcclusion()) * 48);
+
+				const GlbVertex vertex
+				{
+					{
+						(static_cast<float>(face_vertex.x) - static_cast<float>(size.x) * 0.5f) * scale.x,
+						(static_cast<float>(face_vertex.y) - static_cast<float>(size.y) * 0.5f) * scale.y,
+						(static_cast<float>(face_vertex.z) - static_cast<float>(size.z) * 0.5f) * scale.z
+					},
+					{ static_cast<float>(normal[0]), static_cast<float>(normal[1]), static_cast<float>(normal[2]) },
+					{ (static_cast<float>(face_vertex.palette_index) + 0.5f) / 256.0f, 0.5f },
+					{ brightness, brightness, brightness, 255 }
+				};
+				std::memcpy(vertex_data, &vertex, sizeof(GlbVertex));
+				vertex_data += sizeof(GlbVertex);
+			}
+
+			// Split each quad along the diagonal whose corners have the most similar occlusion.
+			uint8* index_data = bin + mesh.index_offset;
+			for (uint32 first = 0; first < mesh.vertices.size(); first += 4)
+			{
+				const sint32 occlusion[4]{ mesh.vertices[first].GetOcclusion(), mesh.vertices[first + 1].GetOcclusion(), mesh.vertices[first + 2].GetOcclusion(), mesh.vertices[first + 3].GetOcclusion() };
+				const uint32 start = (std::abs(occlusion[0] - occlusion[2]) > std::abs(occlusion[1] - occlusion[3])) ? 1 : 0;
+
+				const uint32 indices[6]{ first + start, first + (start + 1) % 4, first + (start + 2) % 4, first + start, first + (start + 2) % 4, first + (start + 3) % 4 };
+				std::memcpy(index_data, indices, sizeof(indices));
+				index_data += sizeof(indices);
+			}
+		});
+
+		for (usize i = 0; i < mesh_placements.size(); i++)
+		{
+			const usize count = mesh_placements[i].size();
+			uint8* const attributes = bin + instance_offsets[i];
+			for (usize j = 0; j < count; j++)
+			{
+				const Matrix& matrix = *placements[mesh_placements[i][j]].matrix;
+
+				// The rows of the matrix are the scaled axes, a negative determinant (mirroring) is moved into the scale of the x axis.
+				float axis_scale[3];
+				Matrix rotation{};
+				for (uint32 row = 0; row < 3; row++)
+				{
+					axis_scale[row] = std::sqrt(matrix.cells[row][0] * matrix.cells[row][0] + matrix.cells[row][1] * matrix.cells[row][1] + matrix.cells[row][2] * matrix.cells[row][2]);
+				}
+				const float determinant = matrix.cells[0][0] * (matrix.cells[1][1] * matrix.cells[2][2] - matrix.cells[1][2] * matrix.cells[2][1]) -
+					matrix.cells[0][1] * (matrix.cells[1][0] * matrix.cells[2][2] - matrix.cells[1][2] * matrix.cells[2][0]) +
+					matrix.cells[0][2] * (matrix.cells[1][0] * matrix.cells[2][1] - matrix.cells[1][1] * matrix.cells[2][0]);
+				if (determinant < 0.0f) axis_scale[0] = -axis_scale[0];
+
+				for (uint32 row = 0; row < 3; row++)
+				{
+					for (uint32 column = 0; column < 3; column++)
+					{
+						rotation.cells[row][column] = (axis_scale[row] != 0.0f) ? matrix.cells[row][column] / axis_scale[row] : 0.0f;
+					}
+				}
+				const Quaternion quaternion = MatrixToQuaternion(rotation);
+
+				const float translation_values[3]{ matrix.cells[3][0], matrix.cells[3][1], matrix.cells[3][2] };
+				const float rotation_values[4]{ quaternion.x, quaternion.y, quaternion.z, quaternion.w };
+				std::memcpy(attributes + (j * 3) * sizeof(float), translation_values, sizeof(translation_values));
+				std::memcpy(attributes + (count * 3 + j * 4) * sizeof(float), rotation_values, sizeof(rotation_values));
+				std::memcpy(attributes + (count * 7 + j * 3) * sizeof(float), axis_scale, sizeof(axis_scale));
+			}
+		}
+
+		write(file_data.data(), file_data.size());
+	}
+
+	RunLengthModel::RunLengthModel(const Model& model, const ReaderSettings& reader_settings) : size{ model.size }, up_axis{ reader_settings.flipped_up_axis ? 1u : 2u }
+	{
+		assert(size.x <= 256 && size.y <= 256 && size.z <= 256 && "Models can be at most 256 voxels in size on every axis!");
+
+		const uint32 sizes[3]{ size.x, size.y, size.z };
+		const uint32 strides[3]{ 1, size.x, size.x * size.y };
+		const uint32 horizontal_axis = 3 - up_axis;
+
+		column_offsets.reserve(size.x * sizes[horizontal_axis] + 1);
+		for (uint32 h = 0; h < sizes[horizontal_axis]; h++)
+		{
+			for (uint32 x = 0; x < size.x; x++)
+			{
+				column_offsets.push_back(static_cast<uint32>(runs.size()));
+
+				const uint8* column = model.voxel_data.data() + x + h * strides[horizontal_axis];
+				for (uint32 height = 0; height < sizes[up_axis]; height++)
+				{
+					const uint8 palette_index = column[height * strides[up_axis]];
+					if (palette_index == 0) continue;
+
+					if (runs.size() > column_offsets.back() && runs.back().palette_index == palette_index && runs.back().last + 1u == height)
+					{
+						runs.back().last++;
+					}
+					else
+					{
+						runs.push_back(Run{ static_cast<uint8>(height), static_cast<uint8>(height), palette_index });
+					}
+				}
+			}
+		}
+		column_offsets.push_back(static_cast<uint32>(runs.size()));
+	}
+
+	uint8 RunLengthModel::GetVoxel(const uint32 x, const uint32 y, const uint32 z) const
+	{
+		const uint32 position[3]{ x, y, z };
+		const uint32 height = position[up_axis];
+
+		// The last run that starts at or below the height is the only one that can contain it.
+		const Column column = GetColumn(x, position[3 - up_axis]);
+		const Run* run = std::upper_bound(column.begin(), column.end(), height, [](const uint32 value, const Run& other) { return value < other.begin; });
+		if (run == column.begin()) return 0;
+
+		--run;
+		return (height <= run->last) ? run->palette_index : 0;
+	}
+
+	Model RunLengthModel::ToModel() const
+	{
+		const uint32 sizes[3]{ size.x, size.y, size.z };
+		const uint32 strides[3]{ 1, size.x, size.x * size.y };
+		const uint32 horizontal_axis = 3 - up_axis;
+
+		Model model;
+		model.size = size;
+		model.voxel_data.resize(static_cast<usize>(size.x) * size.y * size.z, 0);
+
+		for (uint32 h = 0; h < sizes[horizontal_axis]; h++)
+		{
+			for (uint32 x = 0; x < size.x; x++)
+			{
+				uint8* column = model.voxel_data.data() + x + h * strides[horizontal_axis];
+				for (const Run& run : GetColumn(x, h))
+				{
+					for (uint32 height = run.begin; height <= run.last; height++)
+					{
+						column[height * strides[up_axis]] = run.palette_index;
+					}
+				}
+			}
+		}
+
+		return model;
+	}
+
+	namespace
+	{
+		// Builds the columns straight from the packed XYZI voxels, without decoding the dense voxel data.
+		RunLengthModel EncodeRunLengthModel(const Chunk& size_chunk, const Chunk& voxel_chunk, const ReaderSettings& reader_settings)
+		{
+			RunLengthModel model;
+			model.size = ReadModelSize(size_chunk, reader_settings);
+			model.up_axis = reader_settings.flipped_up_axis ? 1 : 2;
+			assert(model.size.x <= 256 && model.size.y <= 256 && model.size.z <= 256 && "Models can be at most 256 voxels in size on every axis!");
+
+			const uint32 horizontal_axis = 3 - model.up_axis;
+			const uint32 column_count = model.size.x * ((horizontal_axis == 1) ? model.size.y : model.size.z);
+
+			const void* data = voxel_chunk.content;
+			const ArrayView<uint32> packed_voxels = ReadArray<uint32>(data);
+
+			// Bucket the voxels by column (counting sort), each as its height followed by its palette index.
+			std::vector<uint32> column_starts(column_count + 1, 0);
+			std::vector<uint32> voxel_columns(packed_voxels.size);
+			for (uint32 i = 0; i < packed_voxels.size; i++)
+			{
+				uint32 position[3];
+				DecodeVoxelPosition(packed_voxels[i], model.size, reader_settings, position[0], position[1], position[2]);
+
+				voxel_columns[i] = position[0] + position[horizontal_axis] * model.size.x;
+				column_starts[voxel_columns[i] + 1]++;
+			}
+			for (uint32 i = 0; i < column_count; i++) column_starts[i + 1] += column_starts[i];
+
+			std::vector<uint16> column_voxels(packed_voxels.size);
+			std::vector<uint32> column_ends(column_starts.begin(), column_starts.end() - 1);
+			for (uint32 i = 0; i < packed_voxels.size; i++)
+			{
+				uint32 position[3];
+				DecodeVoxelPosition(packed_voxels[i], model.size, reader_settings, position[0], position[1], position[2]);
+				column_voxels[column_ends[voxel_columns[i]]++] = static_cast<uint16>((position[model.up_axis] << 8) | (packed_voxels[i] >> 24));
+			}
+
+			model.column_offsets.resize(column_count + 1);
+			model.runs.reserve(packed_voxels.size);
+			for (uint32 i = 0; i < column_count; i++)
+			{
+				model.column_offsets[i] = static_cast<uint32>(model.runs.size());
+
+				// Sort by height only, so the last voxel of the file wins when a position is stored twice (like in the dense voxel data).
+				uint16* const first = column_voxels.data() + column_starts[i];
+				uint16* const last = column_voxels.data() + column_starts[i + 1];
+				std::stable_sort(first, last, [](const uint16 a, const uint16 b) { return (a >> 8) < (b >> 8); });
+
+				for (const uint16* voxel = first; voxel < last; voxel++)
+				{
+					const uint32 height = *voxel >> 8;
+					const uint8 palette_index = static_cast<uint8>(*voxel);
+					if (voxel + 1 < last && (voxel[1] >> 8) == height) continue;
+					if (palette_index == 0) continue;
+
+					std::vector<RunLengthModel::Run>& runs = model.runs;
+					if (runs.size() > model.column_offsets[i] && runs.back().palette_index == palette_index && runs.back().last + 1u == height)
+					{
+						runs.back().last++;
+					}
+					else
+					{
+						runs.push_back(RunLengthModel::Run{ static_cast<uint8>(height), static_cast<uint8>(height), palette_index });
+					}
+				}
+			}
+			model.column_offsets[column_count] = static_cast<uint32>(model.runs.size());
+			model.runs.shrink_to_fit();
+
+			return model;
+		}
+	}
+
+	std::vector<RunLengthModel> LoadRunLengthModels(const void* data, const usize data_size, const ReaderSettings& reader_settings)
+	{
+		const ChunkIndex index = IndexChunks(data, data_size);
+
+		std::vector<RunLengthModel> models(index.models.size());
+		ParallelFor(index.models.size(), [&](const usize i)
+		{
+			models[i] = EncodeRunLengthModel(index.models[i].first, index.models[i].second, reader_settings);
+		});
+
+		return models;
+	}
+
+	ModelEditor::ModelEditor(Model& model) : model{ &model }
+	{
+		brick_count = Model::Size{ (model.size.x + brick_size - 1) / brick_size, (model.size.y + brick_size - 1) / brick_size, (model.size.z + brick_size - 1) / brick_size };
+		dirty_word_count = (brick_count.x * brick_count.y * brick_count.z + 63) / 64;
+		dirty_words = std::make_unique<std::atomic<uint64>[]>(dirty_word_count);
+	}
+
+	ModelEditor::ModelEditor(Scene& scene, const uint32 model_index) : ModelEditor{ scene.models[model_index] }
+	{
+		// Mix in a counter so every editor gives the model a hash that no other model (or previous version of this one) has.
+		static std::atomic<uint64> edit_count{ 0 };
+		if (scene.model_hashes.size() == scene.models.size())
+		{
+			scene.model_hashes[model_index] = MixHash(scene.model_hashes[model_index] ^ MixHash(++edit_count ^ 0x65646974ull));
+		}
+	}
+
+	void ModelEditor::MarkDirty(const uint32 brick_x, const uint32 brick_y, const uint32 brick_z)
+	{
+		const uint32 brick = brick_x + (brick_y * brick_count.x) + (brick_z * brick_count.x * brick_count.y);
+		const uint64 bit = uint64{ 1 } << (brick & 63);
+
+		// Always set the bit with a release operation (even if it looks set already), otherwise an edit racing with a drain that just cleared it would be lost or its voxel write wouldn't be visible to the drain.
+		dirty_words[brick >> 6].fetch_or(bit, std::memory_order_release);
+	}
+
+	void ModelEditor::SetVoxel(const uint32 x, const uint32 y, const uint32 z, const uint8 palette_index)
+	{
+		assert(x < model->size.x && y < model->size.y && z < model->size.z && "Voxel is outside of the model!");
+
+		uint8& voxel = model->voxel_data[x + (y * model->size.x) + (z * model->size.x * model->size.y)];
+		if (voxel == palette_index) return;
+
+		voxel = palette_index;
+		MarkDirty(x / brick_size, y / brick_size, z / brick_size);
+	}
+
+	void ModelEditor::FillBox(const VoxelBox& box, const uint8 palette_index)
+	{
+		const uint32 max_x = std::min<uint32>(box.max_x, model->size.x);
+		const uint32 max_y = std::min<uint32>(box.max_y, model->size.y);
+		const uint32 max_z = std::min<uint32>(box.max_z, model->size.z);
+
+		for (uint32 z = box.min_z; z < max_z; z++)
+		{
+			for (uint32 y = box.min_y; y < max_y; y++)
+			{
+				uint8* const row = model->voxel_data.data() + (y * model->size.x) + (z * model->size.x * model->size.y);
+
+				// Each row is filled one brick wide segment at a time, so only the segments that change mark their brick.
+				for (uint32 x = box.min_x; x < max_x; x = (x / brick_size + 1) * brick_size)
+				{
+					uint8* const first = row + x;
+					uint8* const last = row + std::min((x / brick_size + 1) * brick_size, max_x);
+					if (std::find_if(first, last, [palette_index](const uint8 voxel) { return voxel != palette_index; }) == last) continue;
+
+					std::fill(first, last, palette_index);
+					MarkDirty(x / brick_size, y / brick_size, z / brick_size);
+				}
+			}
+		}
+	}
+
+	void ModelEditor::Fill(const uint8 palette_index)
+	{
+		FillBox(VoxelBox{ 0, 0, 0, static_cast<uint16>(model->size.x), static_cast<uint16>(model->size.y), static_cast<uint16>(model->size.z) }, palette_index);
+	}
+
+	bool ModelEditor::IsDirty() const
+	{
+		for (uint32 i = 0; i < dirty_word_count; i++)
+		{
+			if (dirty_words[i].load(std::memory_order_relaxed) != 0) return true;
+		}
+
+		return false;
+	}
+
+	std::vector<ModelEditor::Brick> ModelEditor::DrainDirtyBricks()
+	{
+		std::vector<Brick> bricks;
+		for (uint32 i = 0; i < dirty_word_count; i++)
+		{
+			// Taking the whole word at once pairs with the release in MarkDirty(), so the voxel writes of the drained bricks are visible to the caller.
+			uint64 word = dirty_words[i].exchange(0, std::memory_order_acquire);
+			while (word != 0)
+			{
+				const uint32 brick = i * 64 + static_cast<uint32>(CountTrailingZeros(word));
+				word &= word - 1;
+
+				bricks.push_back(Brick{ brick % brick_count.x, (brick / brick_count.x) % brick_count.y, brick / (brick_count.x * brick_count.y) });
+			}
+		}
+
+		return bricks;
+	}
+
+	namespace
+	{
+		// Open space of a volume: each layer spans the volume along x and y, each shelf spans its layer along x.
+		struct AtlasShelf
+		{
+			uint32 y;
+			uint32 height;
+			uint32 used_x;
+		};
+
+		struct AtlasLayer
+		{
+			uint32 z;
+			uint32 depth;
+			uint32 used_y;
+			std::vector<AtlasShelf> shelves;
+		};
+
+		struct AtlasVolume
+		{
+			uint32 used_z{ 0 };
+			std::vector<AtlasLayer> layers;
+		};
+
+		bool PlaceInVolume(AtlasVolume& volume, const Model::Size& volume_size, const Model::Size& size, VoxelAtlas::Placement& placement)
+		{
+			for (AtlasLayer& layer : volume.layers)
+			{
+				if (size.z > layer.depth) continue;
+
+				for (AtlasShelf& shelf : layer.shelves)
+				{
+					if (size.y > shelf.height || shelf.used_x + size.x > volume_size.x) continue;
+
+					placement.x = shelf.used_x;
+					placement.y = shelf.y;
+					placement.z = layer.z;
+					shelf.used_x += size.x;
+					return true;
+				}
+
+				if (layer.used_y + size.y <= volume_size.y)
+				{
+					layer.shelves.push_back(AtlasShelf{ layer.used_y, size.y, size.x });
+					placement.x = 0;
+					placement.y = layer.used_y;
+					placement.z = layer.z;
+					layer.used_y += size.y;
+					return true;
+				}
+			}
+
+			if (volume.used_z + size.z > volume_size.z) return false;
+
+			AtlasLayer& layer = volume.layers.emplace_back(AtlasLayer{ volume.used_z, size.z, size.y, {} });
+			layer.shelves.push_back(AtlasShelf{ 0, size.y, size.x });
+			placement.x = 0;
+			placement.y = 0;
+			placement.z = layer.z;
+			volume.used_z += size.z;
+			return true;
+		}
+	}
+
+	VoxelAtlas PackVoxelAtlas(const Scene& scene, const VoxelAtlasSettings& atlas_settings)
+	{
+		VoxelAtlas atlas;
+		atlas.volume_size = atlas_settings.volume_size;
+		atlas.placements.resize(scene.models.size());
+
+		// Only the first model with a given content hash is packed, the others share its placement.
+		const bool has_hashes = (scene.model_hashes.size() == scene.models.size());
+		std::vector<uint32> unique_model_indices(scene.models.size());
+		std::unordered_map<uint64, uint32> first_models;
+		for (uint32 i = 0; i < scene.models.size(); i++)
+		{
+			if (scene.models[i].voxel_data.empty())
+			{
+				unique_model_indices[i] = UINT32_MAX;
+				continue;
+			}
+
+			unique_model_indices[i] = has_hashes ? first_models.try_emplace(scene.model_hashes[i], i).first->second : i;
+			if (unique_model_indices[i] == i) atlas.packed_models.push_back(i);
+		}
+
+		const auto padded_size = [&](const uint32 model_index)
+		{
+			const Model::Size& size = scene.models[model_index].size;
+			return Model::Size{ size.x + atlas_settings.padding, size.y + atlas_settings.padding, size.z + atlas_settings.padding };
+		};
 
-				if (i != 0) continue; // Skip processing all but the first model.
+		// Tallest models first, so each layer is filled with models of a similar height, then by footprint.
+		std::stable_sort(atlas.packed_models.begin(), atlas.packed_models.end(), [&](const uint32 a, const uint32 b)
+		{
+			const Model::Size size_a = padded_size(a);
+			const Model::Size size_b = padded_size(b);
+			if (size_a.z != size_b.z) return size_a.z > size_b.z;
+			if (size_a.y != size_b.y) return size_a.y > size_b.y;
+			return size_a.x > size_b.x;
+		});
+
+		std::vector<AtlasVolume> volumes;
+		for (const uint32 model_index : atlas.packed_models)
+		{
+			// The padding can be left out at the far end of the volume.
+			const Model::Size& model_size = scene.models[model_index].size;
+			const Model::Size& volume_size = atlas_settings.volume_size;
+			const Model::Size size = padded_size(model_index);
+			const Model::Size clamped_size{ std::min(size.x, volume_size.x), std::min(size.y, volume_size.y), std::min(size.z, volume_size.z) };
+			assert(model_size.x <= volume_size.x && model_size.y <= volume_size.y && model_size.z <= volume_size.z && "Model doesn't fit inside of an atlas volume!");
+			if (model_size.x > volume_size.x || model_size.y > volume_size.y || model_size.z > volume_size.z) continue;
 
-				instance_model_index = model_index;
+			VoxelAtlas::Placement& placement = atlas.placements[model_index];
+			for (uint32 i = 0; i < volumes.size() && placement.volume_index == UINT32_MAX; i++)
+			{
+				if (PlaceInVolume(volumes[i], volume_size, clamped_size, placement)) placement.volume_index = i;
+			}
 
-				ReadDict(data); // Model attributes, we can ignore this until implementing animation.
+			if (placement.volume_index == UINT32_MAX)
+			{
+				placement.volume_index = static_cast<uint32>(volumes.size());
+				PlaceInVolume(volumes.emplace_back(), volume_size, clamped_size, placement);
 			}
+		}
+		atlas.volume_count = static_cast<uint32>(volumes.size());
+
+		for (uint32 i = 0; i < scene.models.size(); i++)
+		{
+			if (unique_model_indices[i] != UINT32_MAX && unique_model_indices[i] != i) atlas.placements[i] = atlas.placements[unique_model_indices[i]];
+		}
+
+		return atlas;
+	}
 
-			instances.emplace_back(transform_index, instance_model_index);
+	void VoxelAtlas::WriteVolume(const Scene& scene, const uint32 volume_index, uint8* staging) const
+	{
+		const usize row_stride = volume_size.x;
+		const usize slice_stride = static_cast<usize>(volume_size.x) * volume_size.y;
+		std::memset(staging, 0, slice_stride * volume_size.z);
+
+		std::vector<uint32> volume_models;
+		for (const uint32 model_index : packed_models)
+		{
+			if (placements[model_index].volume_index == volume_index) volume_models.push_back(model_index);
 		}
 
-		return transform_index;
+		// Models don't overlap, so they can be copied into the volume at the same time.
+		ParallelFor(volume_models.size(), [&](const usize i)
+		{
+			const Model& model = scene.models[volume_models[i]];
+			const Placement& placement = placements[volume_models[i]];
+			for (uint32 z = 0; z < model.size.z; z++)
+			{
+				for (uint32 y = 0; y < model.size.y; y++)
+				{
+					const uint8* row = model.voxel_data.data() + (y * model.size.x) + (z * model.size.x * model.size.y);
+					std::memcpy(staging + placement.x + (placement.y + y) * row_stride + (placement.z + z) * slice_stride, row, model.size.x);
+				}
+			}
+		});
 	}
 }
\ No newline at end of file
@@ -1,13 +1,23 @@
 #pragma once
 
+#include <atomic>
+#include <cfloat>
 #include <cstdint>
+#include <iosfwd>
+#include <mutex>
+#include <memory>
+#include <memory_resource>
 #include <string>
 #include <vector>
+#include <functional>
+#include <unordered_map>
 
 namespace VoxReader
 {
 	using uint8 = std::uint8_t;
+	using uint16 = std::uint16_t;
 	using uint32 = std::uint32_t;
+	using uint64 = std::uint64_t;
 	using sint32 = std::int32_t;
 	using usize = std::size_t;
 
@@ -38,6 +48,10 @@ namespace VoxReader
 		float w{ 1.0f }; 
 	};
 
+	class Transform;
+	struct Layer;
+	class ModelCache;
+
 	struct ReaderSettings
 	{
 		enum CoordSystem : sint32
@@ -61,6 +75,24 @@ namespace VoxReader
 		// Avoid instance transforms with negative scale by creating an inverted duplicate of the voxel model it uses.
 		bool avoid_negative_scale{ true };
 
+		// Skip transforms that are hidden, together with all of their children.
+		bool skip_hidden_transforms{ false };
+		// Skip transforms that are in a hidden layer, together with all of their children.
+		bool skip_hidden_layers{ false };
+		// Optional filter that is called for every transform (layer is nullptr if the transform isn't in a layer), returning false skips the transform together with all of its children.
+		std::function<bool(const Transform& transform, const Layer* layer)> transform_filter;
+		// When any of the filters above are used, models that aren't used by any of the remaining instances aren't decoded and are left empty (size 0).
+
+		// Decode models with identical content only once, instances of duplicates use the first model with the same content and the duplicates are left empty (size 0).
+		bool deduplicate_models{ false };
+		// Optional cache that can be shared between scenes, models that are already in the cache are copied from it instead of being decoded.
+		ModelCache* model_cache{ nullptr };
+
+		// Memory resource all of the scene's data is allocated from (the default resource if nullptr), it has to outlive the scene. It's only used by the thread that loads the scene, so it doesn't have to be thread safe.
+		std::pmr::memory_resource* memory_resource{ nullptr };
+		// Allocate all of the scene's data from a monotonic arena owned by the scene (ignored if memory_resource is set), so it lives in a few large blocks that are freed at once with the scene.
+		bool use_arena{ false };
+
 		// Internal use for converting coordinate systems. Use ReadSettings::SetCoordinateSystem() to generate them.
 		Matrix coord_system_matrix{};
 		Matrix inverse_coord_system_matrix{};
@@ -71,14 +103,24 @@ namespace VoxReader
 	class Transform
 	{
 	public:
-		Transform(const Vector& position, uint8 rotation, const ReaderSettings& reader_settings);
+		using allocator_type = std::pmr::polymorphic_allocator<char>;
+
+		Transform(const Vector& position, uint8 rotation, const ReaderSettings& reader_settings, const allocator_type& allocator = {});
+		Transform(const Transform& other, const allocator_type& allocator);
+		Transform(Transform&& other, const allocator_type& allocator);
+		Transform(const Transform&) = default;
+		Transform(Transform&&) noexcept = default;
+		Transform& operator=(const Transform&) = default;
+		Transform& operator=(Transform&&) = default;
 
 		[[nodiscard]] Vector& GetPosition() { return reinterpret_cast<Vector&>(matrix.cells[3][0]); }
 		[[nodiscard]] const Vector& GetPosition() const { return reinterpret_cast<const Vector&>(matrix.cells[3][0]); }
 
-		std::string name;
+		std::pmr::string name;
 		Matrix matrix{};
 		bool hidden{ false };
+		// Index into Scene::layers, UINT32_MAX if the transform isn't in a layer.
+		uint32 layer_index{ UINT32_MAX };
 
 		Vector local_position{};
 		Quaternion local_rotation{};
@@ -93,11 +135,36 @@ namespace VoxReader
 			uint32 z;
 		};
 
+		using allocator_type = std::pmr::polymorphic_allocator<uint8>;
+
 		Model() = default;
-		Model(const Size& size, std::vector<uint8>&& voxel_data) : size{size}, voxel_data{std::move(voxel_data)} {}
+		explicit Model(const allocator_type& allocator) : voxel_data{ allocator } {}
+		Model(const Size& size, std::pmr::vector<uint8>&& voxel_data, const allocator_type& allocator = {}) : size{ size }, voxel_data{ std::move(voxel_data), allocator } {}
+		Model(const Model& other, const allocator_type& allocator) : size{ other.size }, voxel_data{ other.voxel_data, allocator } {}
+		Model(Model&& other, const allocator_type& allocator) : size{ other.size }, voxel_data{ std::move(other.voxel_data), allocator } {}
+		Model(const Model&) = default;
+		Model(Model&&) noexcept = default;
+		Model& operator=(const Model&) = default;
+		Model& operator=(Model&&) = default;
 
 		Size size;
-		std::vector<uint8> voxel_data;
+		std::pmr::vector<uint8> voxel_data;
+	};
+
+	// Thread safe cache of decoded models keyed by content hash (see Scene::model_hashes), set ReaderSettings::model_cache to share it between scenes.
+	class ModelCache
+	{
+	public:
+		[[nodiscard]] std::shared_ptr<const Model> Find(uint64 key) const;
+		// Adds a copy of the model if the key isn't in the cache yet, returns the cached model.
+		std::shared_ptr<const Model> Insert(uint64 key, const Model& model);
+
+		void Clear();
+		[[nodiscard]] usize GetSize() const;
+
+	private:
+		mutable std::mutex mutex;
+		std::unordered_map<uint64, std::shared_ptr<const Model>> models;
 	};
 
 	struct Instance
@@ -111,11 +178,37 @@ namespace VoxReader
 
 	struct Group
 	{
+		using allocator_type = std::pmr::polymorphic_allocator<uint32>;
+
 		Group() = default;
-		Group(const uint32 transform_index, std::vector<uint32>&& child_transform_indices) : transform_index{ transform_index }, child_transform_indices{ std::move(child_transform_indices) } {}
+		explicit Group(const allocator_type& allocator) : child_transform_indices{ allocator } {}
+		Group(const uint32 transform_index, std::pmr::vector<uint32>&& child_transform_indices, const allocator_type& allocator = {}) : transform_index{ transform_index }, child_transform_indices{ std::move(child_transform_indices), allocator } {}
+		Group(const Group& other, const allocator_type& allocator) : transform_index{ other.transform_index }, child_transform_indices{ other.child_transform_indices, allocator } {}
+		Group(Group&& other, const allocator_type& allocator) : transform_index{ other.transform_index }, child_transform_indices{ std::move(other.child_transform_indices), allocator } {}
+		Group(const Group&) = default;
+		Group(Group&&) noexcept = default;
+		Group& operator=(const Group&) = default;
+		Group& operator=(Group&&) = default;
 
 		uint32 transform_index;
-		std::vector<uint32> child_transform_indices;
+		std::pmr::vector<uint32> child_transform_indices;
+	};
+
+	struct Layer
+	{
+		using allocator_type = std::pmr::polymorphic_allocator<char>;
+
+		Layer() = default;
+		explicit Layer(const allocator_type& allocator) : name{ allocator } {}
+		Layer(const Layer& other, const allocator_type& allocator) : name{ other.name, allocator }, hidden{ other.hidden } {}
+		Layer(Layer&& other, const allocator_type& allocator) : name{ std::move(other.name), allocator }, hidden{ other.hidden } {}
+		Layer(const Layer&) = default;
+		Layer(Layer&&) noexcept = default;
+		Layer& operator=(const Layer&) = default;
+		Layer& operator=(Layer&&) = default;
+
+		std::pmr::string name;
+		bool hidden{ false };
 	};
 
 	struct Material
@@ -169,11 +262,99 @@ namespace VoxReader
 		uint8 a{ 0 };
 	};
 
+	// Bytes used by the parts of a scene.
+	struct MemoryUsage
+	{
+		// Voxel data of all models.
+		usize voxel_data{ 0 };
+		// Model structs, model hashes and mirrored model pairs.
+		usize models{ 0 };
+		usize transforms{ 0 };
+		// Transform and layer names that don't fit inside of the string objects themselves.
+		usize names{ 0 };
+		// Group structs and their child transform indices.
+		usize groups{ 0 };
+		usize instances{ 0 };
+		// Layers, the palette, the materials and the scene object itself.
+		usize other{ 0 };
+
+		[[nodiscard]] usize GetTotal() const { return voxel_data + models + transforms + names + groups + instances + other; }
+	};
+
+	// Estimated memory usage of a file once it's loaded.
+	struct MemoryEstimate
+	{
+		MemoryUsage usage;
+		// Non-empty voxels of all models, a sparse representation would take about 4 bytes per voxel instead of the dense voxel data.
+		usize voxel_count{ 0 };
+	};
+
+	// Differences between two versions of a scene, see Scene::Reload().
+	struct SceneChanges
+	{
+		struct IndexChanges
+		{
+			[[nodiscard]] bool IsEmpty() const { return added.empty() && removed.empty() && modified.empty(); }
+
+			// Indices that only exist in the new version.
+			std::vector<uint32> added;
+			// Indices that only existed in the old version.
+			std::vector<uint32> removed;
+			// Indices that exist in both versions, but with different content.
+			std::vector<uint32> modified;
+		};
+
+		[[nodiscard]] bool IsEmpty() const { return models.IsEmpty() && transforms.IsEmpty() && instances.IsEmpty() && layers.IsEmpty() && palette.IsEmpty() && materials.IsEmpty(); }
+
+		IndexChanges models;
+		IndexChanges transforms;
+		IndexChanges instances;
+		IndexChanges layers;
+		// Palette and material changes only have modified indices.
+		IndexChanges palette;
+		IndexChanges materials;
+	};
+
 	class Scene
 	{
 	public:
+		// Reads up to byte_count bytes into the buffer, returns the number of bytes read (0 once the end of the file is reached).
+		using ReadCallback = std::function<usize(void* buffer, usize byte_count)>;
+		// Receives the written file data.
+		using WriteCallback = std::function<void(const void* data, usize byte_count)>;
+
 		Scene() = default;
+		// Empty scene that allocates its data like a loaded scene would (see ReaderSettings::memory_resource and ReaderSettings::use_arena).
+		explicit Scene(const ReaderSettings& reader_settings);
 		Scene(const void* data, usize data_size, const ReaderSettings& reader_settings = {});
+		// Streams the file chunk by chunk through a single reused buffer, so the peak memory use depends on the largest chunk instead of the file size.
+		// Since models come before the layers in a file, models that get filtered out are still decoded (and released afterwards) when streaming.
+		Scene(std::istream& stream, const ReaderSettings& reader_settings = {});
+		Scene(const ReadCallback& read, const ReaderSettings& reader_settings = {});
+
+		// Writes the scene as a .vox file, pass the reader settings the scene was read with to undo the coordinate system, voxel scale, voxel offsets and mirrored models.
+		// Empty and mirrored models are left out of the file. The whole file is encoded into a single buffer (the models in parallel) that is written all at once.
+		void Write(std::ostream& stream, const ReaderSettings& reader_settings = {}) const;
+		void Write(const WriteCallback& write, const ReaderSettings& reader_settings = {}) const;
+
+		// Reloads the scene from a new version of its file (pass the reader settings it was loaded with), moving over the voxel data of models whose content hash didn't change instead of decoding them again.
+		// Elements are compared index by index (MagicaVoxel keeps the indices of unchanged models and nodes when saving), so only the changed ones have to be rebuilt by caches of meshes or GPU buffers.
+		SceneChanges Reload(const void* data, usize data_size, const ReaderSettings& reader_settings = {});
+
+		// Copies allocate their data from the default memory resource.
+		Scene(const Scene&) = default;
+		Scene(Scene&&) noexcept = default;
+		// Assignment rebuilds the scene in place, so its old data is destroyed before the arena it might be allocated from.
+		Scene& operator=(const Scene& other);
+		Scene& operator=(Scene&& other) noexcept;
+
+		[[nodiscard]] std::pmr::memory_resource* GetMemoryResource() const { return models.get_allocator().resource(); }
+
+		// Bytes used by the scene's data (based on the capacity of the containers), when the scene uses an arena the arena can hold more than this.
+		[[nodiscard]] MemoryUsage GetMemoryUsage() const;
+		// Estimates the memory usage of a file before loading it, using only the chunk headers, the SIZE chunks and the XYZI voxel counts.
+		// Names and mirrored models created to avoid negative scale aren't part of the estimate, deduplicated and filtered out models are.
+		[[nodiscard]] static MemoryEstimate EstimateMemoryUsage(const void* data, usize data_size);
 
 		// Converts a palette color (uint32) into its rgba components (1 byte per component).
 		[[nodiscard]] Color PaletteToColor(const usize i) const
@@ -188,18 +369,455 @@ namespace VoxReader
 			};
 		}
 
-		std::vector<Transform> transforms;
-		std::vector<Model> models;
+		// Arena that owns the scene's data if ReaderSettings::use_arena was set, declared first so it's destroyed last.
+		std::shared_ptr<std::pmr::memory_resource> arena;
+
+		std::pmr::vector<Transform> transforms;
+		std::pmr::vector<Model> models;
+		// Hash of each model's content in the file (SIZE and XYZI chunks), equal hashes mean equal models.
+		// Functions that change voxel data in place (UnifyPalettes(), a ModelEditor created from the scene) replace the hashes of the models they change, other changes have to update the hash as well.
+		std::pmr::vector<uint64> model_hashes;
+		// Pairs of (original, mirrored) model indices of the mirrored models that were added to avoid negative scale (see ReaderSettings::avoid_negative_scale).
+		std::pmr::vector<std::pair<uint32, uint32>> mirrored_models;
 
-		std::vector<Instance> instances;
-		std::vector<Group> groups;
+		std::pmr::vector<Instance> instances;
+		std::pmr::vector<Group> groups;
+		std::pmr::vector<Layer> layers;
 
 		// Colors with format RGBA (index 0 means the voxel is empty).
 		uint32 palette[256]{};
 		// Material palette.
 		Material materials[256]{};
+		// Palette indices in the order MagicaVoxel displays them (IMAP chunk), only valid if has_index_map is set.
+		uint8 index_map[256]{};
+		bool has_index_map{ false };
+	};
+
+	// Loads a scene from memory on a separate thread, reporting the parts of the scene as they become available.
+	class AsyncSceneLoad
+	{
+	public:
+		// Called from the loading thread, the scene must only be accessed from within the callbacks until the load is done. Callbacks may cancel or drop the load themselves.
+		// No new callbacks are started once the loading thread sees the cancellation, but one that is already running can still finish after Cancel() returns.
+		struct Callbacks
+		{
+			std::function<void(const Scene& scene)> on_palette;
+			std::function<void(const Scene& scene)> on_materials;
+			// The transforms, instances, groups, layers and model sizes are final, the voxel data of the models isn't decoded yet.
+			std::function<void(const Scene& scene)> on_scene_graph;
+			std::function<void(const Scene& scene, uint32 model_index)> on_model;
+		};
+
+		AsyncSceneLoad(std::vector<uint8> file_data, const ReaderSettings& reader_settings = {}, Callbacks callbacks = {});
+		// Cancels the load if it's still running, without waiting for the loading thread (see Wait()).
+		~AsyncSceneLoad();
+
+		AsyncSceneLoad(AsyncSceneLoad&&) noexcept = default;
+		AsyncSceneLoad& operator=(AsyncSceneLoad&& other) noexcept;
+
+		// Range [0.0 ~ 1.0], based on the amount of voxel data that has been decoded.
+		[[nodiscard]] float GetProgress() const;
+		[[nodiscard]] bool IsDone() const;
+		[[nodiscard]] bool IsCancelled() const;
+
+		// Stops the load as soon as possible, returns without waiting for the loading thread.
+		void Cancel();
+		// Waits until the loading thread is done, after which it doesn't use ReaderSettings::memory_resource and ReaderSettings::model_cache anymore.
+		// Those have to outlive the loading thread, so call this (or Get()) before destroying them, also after cancelling. Must not be called from a callback.
+		void Wait() const;
+		// Waits for the load to finish and returns the scene (an empty scene if it got cancelled), can only be called once.
+		[[nodiscard]] Scene Get();
+
+		// Internal state that is shared with the loading thread.
+		struct State;
 
 	private:
-		uint32 ParseSceneGraph(const void*& data, const ReaderSettings& reader_settings, uint32 parent_transform_index = UINT32_MAX);
+		// Cancels the load and drops this object's share of the state.
+		void Release();
+
+		std::shared_ptr<State> state;
+	};
+
+	// Occupancy bitmask of a model, one bit per voxel packed in 64 bit words along the x axis, with a coarse level of 8x8x8 bricks on top to skip empty space.
+	class Occupancy
+	{
+	public:
+		static constexpr uint32 brick_size = 8;
+
+		Occupancy() = default;
+		explicit Occupancy(const Model& model);
+
+		[[nodiscard]] const uint64* GetRow(const uint32 y, const uint32 z) const { return &words[(y + z * size.y) * words_per_row]; }
+
+		[[nodiscard]] bool IsOccupied(const uint32 x, const uint32 y, const uint32 z) const
+		{
+			return (GetRow(y, z)[x >> 6] >> (x & 63)) & 0b1;
+		}
+
+		[[nodiscard]] bool IsBrickOccupied(const uint32 brick_x, const uint32 brick_y, const uint32 brick_z) const
+		{
+			return bricks[brick_x + (brick_y * brick_count.x) + (brick_z * brick_count.x * brick_count.y)] != 0;
+		}
+
+		Model::Size size{ 0, 0, 0 };
+		Model::Size brick_count{ 0, 0, 0 };
+		uint32 words_per_row{ 0 };
+
+		// Rows of voxel bits, row (y, z) starts at word (y + z * size.y) * words_per_row.
+		std::vector<uint64> words;
+		// One byte per brick, non-zero if any voxel in the brick is occupied.
+		std::vector<uint8> bricks;
 	};
-}
+
+	// A voxel with at least one face that isn't covered by a neighboring voxel (voxels outside of the model count as empty).
+	struct SurfaceVoxel
+	{
+		enum Face : uint8
+		{
+			NEGATIVE_X = 1 << 0,
+			POSITIVE_X = 1 << 1,
+			NEGATIVE_Y = 1 << 2,
+			POSITIVE_Y = 1 << 3,
+			NEGATIVE_Z = 1 << 4,
+			POSITIVE_Z = 1 << 5
+		};
+
+		// Models are at most 256 voxels in size on every axis.
+		uint8 x;
+		uint8 y;
+		uint8 z;
+		// Bitmask of Face values.
+		uint8 exposed_faces;
+	};
+
+	// Finds all voxels with exposed faces, ordered by z, y and then x. Works on 64 voxels at a time using the rows of the occupancy bitmask.
+	[[nodiscard]] std::vector<SurfaceVoxel> ExtractSurface(const Occupancy& occupancy);
+	[[nodiscard]] std::vector<SurfaceVoxel> ExtractSurface(const Model& model);
+
+	// Corner of an exposed voxel face, every exposed face is emitted as a quad of 4 vertices in counter-clockwise order (seen from outside the model).
+	struct FaceVertex
+	{
+		// Corner position in voxels, in the range [0 ~ 256].
+		uint16 x;
+		uint16 y;
+		uint16 z;
+		// Bits [0 ~ 2] contain the face index (bit index of the SurfaceVoxel::Face value), bits [3 ~ 4] the ambient occlusion of the corner (0 is fully occluded, 3 is unoccluded).
+		uint8 face_and_occlusion;
+		uint8 palette_index;
+
+		[[nodiscard]] uint8 GetFace() const { return face_and_occlusion & 0b111; }
+		[[nodiscard]] uint8 GetOcclusion() const { return face_and_occlusion >> 3; }
+	};
+
+	// Generates the vertices of all exposed faces, with MagicaVoxel style ambient occlusion per corner based on the 2 side and 1 corner neighbors in front of the face.
+	// The occlusion is evaluated for 64 voxels at a time using the rows of the occupancy bitmask.
+	// Every quad is returned as 4 corner vertices without triangulating it, so callers have to pick the diagonal to split along from the 4 corner occlusion values themselves (splitting along the diagonal with the most similar values avoids anisotropy artifacts).
+	[[nodiscard]] std::vector<FaceVertex> ExtractFaceVertices(const Occupancy& occupancy, const Model& model);
+	[[nodiscard]] std::vector<FaceVertex> ExtractFaceVertices(const Model& model);
+
+	struct Ray
+	{
+		Vector origin{};
+		// Doesn't have to be normalized, hit distances are expressed in multiples of the direction's length.
+		Vector direction{ 0.0f, 0.0f, 1.0f };
+		float max_distance{ FLT_MAX };
+	};
+
+	struct RaycastHit
+	{
+		bool hit{ false };
+		float distance{ FLT_MAX };
+
+		uint32 instance_index{ UINT32_MAX };
+		uint32 model_index{ UINT32_MAX };
+
+		// Coordinates of the hit voxel in the model's voxel data.
+		uint32 voxel_x{ 0 };
+		uint32 voxel_y{ 0 };
+		uint32 voxel_z{ 0 };
+
+		// World space normal of the face that was hit.
+		Vector normal{};
+		uint8 palette_index{ 0 };
+	};
+
+	// Traces rays against the instances of a scene using a hierarchical DDA (Amanatides-Woo) over each model's bricks and voxels.
+	// Models are placed centered on their instance's transform position and scaled by voxel_scale (matching the scene when ReaderSettings::add_voxel_offsets is set), hidden instances are ignored.
+	// The scene has to outlive the raycaster.
+	class Raycaster
+	{
+	public:
+		Raycaster(const Scene& scene, const ReaderSettings& reader_settings = {});
+
+		[[nodiscard]] RaycastHit Trace(const Ray& ray) const;
+
+		// Traces packets of 4 rays at a time spread over all hardware threads, hits[i] receives the result of rays[i].
+		void TraceBatch(const Ray* rays, RaycastHit* hits, usize ray_count) const;
+
+	private:
+		struct InstanceData
+		{
+			// Maps world space positions to the model's voxel grid (rows 0-2 rotate and scale, row 3 translates).
+			Matrix world_to_grid{};
+			// World space bounds of the instance.
+			Vector bounds_min{};
+			Vector bounds_max{};
+
+			uint32 instance_index;
+			uint32 model_index;
+		};
+
+		void TraceInstance(const Ray& ray, const InstanceData& instance, RaycastHit& hit) const;
+
+		const Scene* scene{ nullptr };
+		std::vector<Occupancy> occupancies;
+		std::vector<InstanceData> instance_data;
+	};
+
+	struct MipChainSettings
+	{
+		enum Reduction : uint8
+		{
+			// The most frequent non-empty palette index of the 2x2x2 voxels, only empty if all voxels are empty.
+			MOST_FREQUENT,
+			// Like MOST_FREQUENT, but empty if less than occupancy_threshold of the 2x2x2 voxels are non-empty.
+			OCCUPANCY_THRESHOLD
+		} reduction{ MOST_FREQUENT };
+
+		// Range [1 ~ 8], only used by OCCUPANCY_THRESHOLD.
+		uint32 occupancy_threshold{ 4 };
+		// Maximum amount of levels to generate, generation also stops once a level is 1 voxel in size on every axis.
+		uint32 max_levels{ UINT32_MAX };
+	};
+
+	// Generates the downsampled levels of a model (halving the size each level, rounding up), the first element is the 2x downsampled model.
+	[[nodiscard]] std::vector<Model> GenerateMipChain(const Model& model, const MipChainSettings& settings = {});
+	// Generates the mip chains of all models of a scene in parallel, indexed by model index.
+	[[nodiscard]] std::vector<std::vector<Model>> GenerateMipChains(const Scene& scene, const MipChainSettings& settings = {});
+
+	// Signed distance field of a model in voxels (negative inside), measured as the distance between the centers of a voxel and the closest voxel of the other kind minus half a voxel (voxels outside the model count as empty).
+	// This is exact along the axes but overestimates the distance to a diagonal neighbour's face (sqrt(2) - 0.5 instead of sqrt(0.5)), so it isn't a strict lower bound for sphere tracing.
+	// The distances are quantized to 8 bits and stored in bricks of 8x8x8 voxels, so neighbouring voxels in all directions are close in memory.
+	class DistanceField
+	{
+	public:
+		static constexpr uint32 brick_size = 8;
+
+		DistanceField() = default;
+		// Distances are clamped to the range [-max_distance ~ max_distance].
+		explicit DistanceField(const Model& model, float max_distance = 8.0f);
+
+		[[nodiscard]] uint8 GetQuantized(const uint32 x, const uint32 y, const uint32 z) const
+		{
+			const uint32 brick = (x / brick_size) + ((y / brick_size) * brick_count.x) + ((z / brick_size) * brick_count.x * brick_count.y);
+			return data[brick * brick_size * brick_size * brick_size + (x % brick_size) + ((y % brick_size) * brick_size) + ((z % brick_size) * brick_size * brick_size)];
+		}
+
+		[[nodiscard]] float GetDistance(const uint32 x, const uint32 y, const uint32 z) const
+		{
+			return (static_cast<float>(GetQuantized(x, y, z)) - 128.0f) * (max_distance / 127.0f);
+		}
+
+		Model::Size size{ 0, 0, 0 };
+		Model::Size brick_count{ 0, 0, 0 };
+		float max_distance{ 0.0f };
+
+		// 512 bytes per brick (bricks and the voxels inside them are in x, y, z order), 128 means a distance of 0, 1 is -max_distance and 255 is max_distance.
+		std::vector<uint8> data;
+	};
+
+	// Axis aligned box of voxels in a model, from min (inclusive) to max (exclusive) in voxel coordinates.
+	struct VoxelBox
+	{
+		uint16 min_x;
+		uint16 min_y;
+		uint16 min_z;
+		uint16 max_x;
+		uint16 max_y;
+		uint16 max_z;
+	};
+
+	// Decomposes the non-empty voxels of a model into a small set of non-overlapping boxes, greedily growing each box along x, then y, then z.
+	[[nodiscard]] std::vector<VoxelBox> DecomposeBoxes(const Model& model);
+
+	// Box decompositions of all models of a scene in one flat array.
+	struct SceneBoxes
+	{
+		struct Range
+		{
+			uint32 offset;
+			uint32 count;
+		};
+
+		[[nodiscard]] const VoxelBox* GetBoxes(const uint32 model_index) const { return boxes.data() + model_ranges[model_index].offset; }
+		[[nodiscard]] uint32 GetBoxCount(const uint32 model_index) const { return model_ranges[model_index].count; }
+
+		std::vector<VoxelBox> boxes;
+		// Range of boxes per model index, models with equal content (see Scene::model_hashes) share the same range.
+		std::vector<Range> model_ranges;
+	};
+
+	// Decomposes every unique model of a scene once, in parallel.
+	[[nodiscard]] SceneBoxes DecomposeBoxes(const Scene& scene);
+
+	// Palette and material table shared by multiple scenes, see UnifyPalettes().
+	struct SharedPalette
+	{
+		// Colors with format RGBA (index 0 means the voxel is empty).
+		uint32 palette[256]{};
+		Material materials[256]{};
+		// Number of used palette indices, including index 0.
+		uint32 color_count{ 1 };
+	};
+
+	// Builds one palette and material table for all scenes and rewrites the voxel data of every model through a 256 entry lookup table (in parallel, using SSSE3 shuffles when available).
+	// Only used colors are added, in the order MagicaVoxel displays them (see Scene::index_map), equal (color, material) pairs are added once.
+	// When more than 255 unique pairs are used, the remaining ones are mapped to the closest color with the same material type (or any material if there's none).
+	// Afterwards every scene uses the shared palette and materials, and no longer has an index map.
+	SharedPalette UnifyPalettes(const std::vector<Scene*>& scenes);
+
+	struct GlbExportSettings
+	{
+		// Place all instances of a model with a single node using the EXT_mesh_gpu_instancing extension, instead of one node per instance.
+		bool gpu_instancing{ false };
+		// Store the ambient occlusion of each vertex (see FaceVertex) as its vertex color.
+		bool ambient_occlusion{ true };
+		// Also export the instances of hidden transforms.
+		bool include_hidden{ false };
+	};
+
+	// Exports the scene as a binary glTF file (.glb), use a right handed, y up coordinate system when reading the scene to match glTF (see ReaderSettings::SetCoordinateSystem()).
+	// Every unique model is meshed once (in parallel) and shared by the nodes of all its instances, the palette becomes a 256x1 texture that the vertices index into.
+	// The whole file is laid out up front, so the mesh data is written straight into the binary chunk of a single buffer that is written all at once.
+	void ExportGlb(const Scene& scene, std::ostream& stream, const ReaderSettings& reader_settings = {}, const GlbExportSettings& export_settings = {});
+	void ExportGlb(const Scene& scene, const Scene::WriteCallback& write, const ReaderSettings& reader_settings = {}, const GlbExportSettings& export_settings = {});
+
+	// Model stored as runs of equal voxels along the up axis (z, or y when the up axis was flipped by ReaderSettings::SetCoordinateSystem()), with a sorted list of runs per column.
+	// Terrain-like models with long vertical runs of one color take a fraction of the memory of the dense voxel data.
+	class RunLengthModel
+	{
+	public:
+		struct Run
+		{
+			// First and last height of the run along the up axis.
+			uint8 begin;
+			uint8 last;
+			uint8 palette_index;
+		};
+
+		struct Column
+		{
+			[[nodiscard]] const Run* begin() const { return first; }
+			[[nodiscard]] const Run* end() const { return first + count; }
+
+			const Run* first;
+			uint32 count;
+		};
+
+		RunLengthModel() = default;
+		// Encodes a decoded model, pass the reader settings the model was read with so the up axis matches.
+		explicit RunLengthModel(const Model& model, const ReaderSettings& reader_settings = {});
+
+		// Looks up a voxel with a binary search over the runs of its column, O(log runs).
+		[[nodiscard]] uint8 GetVoxel(uint32 x, uint32 y, uint32 z) const;
+		// Runs of the column at x and the horizontal position h (y or z, whichever isn't the up axis), ordered from bottom to top.
+		[[nodiscard]] Column GetColumn(const uint32 x, const uint32 h) const
+		{
+			const uint32 column_index = x + h * size.x;
+			return Column{ runs.data() + column_offsets[column_index], column_offsets[column_index + 1] - column_offsets[column_index] };
+		}
+
+		// Expands the runs back into a model with dense voxel data.
+		[[nodiscard]] Model ToModel() const;
+
+		Model::Size size{ 0, 0, 0 };
+		// Axis the runs go along, 1 (y) or 2 (z).
+		uint32 up_axis{ 2 };
+		// Index of the first run of each column followed by the total run count, the columns are ordered by x and then by the horizontal position h.
+		std::vector<uint32> column_offsets;
+		std::vector<Run> runs;
+	};
+
+	// Encodes all models of a file straight from their XYZI chunks into run length columns (in parallel), without decoding the dense voxel data.
+	// The models are in file order, using the coordinate system of the reader settings (the scene graph related settings are ignored).
+	[[nodiscard]] std::vector<RunLengthModel> LoadRunLengthModels(const void* data, usize data_size, const ReaderSettings& reader_settings = {});
+
+	// Edits the voxels of a model while tracking which 8x8x8 bricks changed, so meshes, colliders and GPU copies only have to update those bricks.
+	// Edits can be made from multiple threads at once as long as they don't write the same voxels, the dirty bricks of all threads are coalesced into one set.
+	// The model has to outlive the editor and its size can't change.
+	class ModelEditor
+	{
+	public:
+		static constexpr uint32 brick_size = 8;
+
+		struct Brick
+		{
+			uint32 x;
+			uint32 y;
+			uint32 z;
+		};
+
+		explicit ModelEditor(Model& model);
+		// Also replaces the model's hash in Scene::model_hashes with a new unique one, since it no longer matches the model's content once it's edited.
+		ModelEditor(Scene& scene, uint32 model_index);
+
+		// Edits only mark bricks as dirty if they actually change a voxel.
+		void SetVoxel(uint32 x, uint32 y, uint32 z, uint8 palette_index);
+		// Sets all voxels inside of the box (clamped to the model's size).
+		void FillBox(const VoxelBox& box, uint8 palette_index);
+		void Fill(uint8 palette_index);
+
+		[[nodiscard]] bool IsDirty() const;
+		// Returns the bricks that changed since the last drain (ordered by x, then y and then z) and clears them, edits made after a brick was drained mark it dirty again.
+		[[nodiscard]] std::vector<Brick> DrainDirtyBricks();
+
+		[[nodiscard]] const Model& GetModel() const { return *model; }
+		[[nodiscard]] const Model::Size& GetBrickCount() const { return brick_count; }
+
+	private:
+		void MarkDirty(uint32 brick_x, uint32 brick_y, uint32 brick_z);
+
+		Model* model;
+		Model::Size brick_count{ 0, 0, 0 };
+		// One bit per brick, with bricks ordered like Occupancy::bricks.
+		std::unique_ptr<std::atomic<uint64>[]> dirty_words;
+		uint32 dirty_word_count{ 0 };
+	};
+
+	struct VoxelAtlasSettings
+	{
+		// Size in voxels of every atlas volume (3D texture), models have to fit inside of it.
+		Model::Size volume_size{ 256, 256, 256 };
+		// Empty voxels kept after each model on every axis, so sampling with filtering doesn't blend neighboring models.
+		uint32 padding{ 0 };
+	};
+
+	// Placement of the models of a scene in a set of fixed size volumes, see PackVoxelAtlas().
+	struct VoxelAtlas
+	{
+		struct Placement
+		{
+			// UINT32_MAX for empty models, which aren't placed.
+			uint32 volume_index{ UINT32_MAX };
+			// Position of the model's corner in the volume.
+			uint32 x{ 0 };
+			uint32 y{ 0 };
+			uint32 z{ 0 };
+		};
+
+		// Writes the voxels of one volume into a buffer of volume_size.x * volume_size.y * volume_size.z bytes (x first, then y and then z), such as a mapped staging buffer.
+		// The models are copied in parallel and everything around them is set to 0, uploading the volumes in order uploads the whole atlas.
+		void WriteVolume(const Scene& scene, uint32 volume_index, uint8* staging) const;
+
+		Model::Size volume_size{ 0, 0, 0 };
+		uint32 volume_count{ 0 };
+		// Placement per model index, models with equal content (see Scene::model_hashes) share a placement.
+		std::vector<Placement> placements;
+		// Models that own their placement, in the order they were packed.
+		std::vector<uint32> packed_models;
+	};
+
+	// Packs all unique non-empty models of a scene into as few volumes as possible, without rotating them.
+	// Models are sorted by height and footprint and placed first fit into layers along z, shelves along y and rows along x, which only takes the model sizes (no GPU needed).
+	[[nodiscard]] VoxelAtlas PackVoxelAtlas(const Scene& scene, const VoxelAtlasSettings& atlas_settings = {});
+}
\ No newline at end of file